@@ -35,23 +35,25 @@
 #include <QFileDialog>
 #include <QProgressBar>
 #include <QThread>
+#include <QThreadPool>
 
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <numeric>
 #include <assert.h>
 
 using namespace lingvo;
 
 class DictionaryEntry {
-    std::unique_ptr<common::FileStream> _stream;
+    std::unique_ptr<common::MappedFileStream> _stream;
     QString _path;
     QString _fileName;
 protected:
     std::unique_ptr<common::BitStreamAdapter> _adapter;
 public:
     DictionaryEntry(QString path)
-        : _stream(new common::FileStream(std::filesystem::u8path(path.toStdString()))),
+        : _stream(new common::MappedFileStream(std::filesystem::u8path(path.toStdString()))),
           _path(path),
           _fileName(QFileInfo(path).fileName()),
           _adapter(new common::BitStreamAdapter(_stream.get()))
@@ -66,6 +68,8 @@ public:
     virtual QString version() = 0;
     virtual std::vector<unsigned char> const& icon() = 0;
     virtual bool supported() = 0;
+    // whether dump can run on a pool thread next to other conversions
+    virtual bool concurrent() { return true; }
     virtual void dump(QString outDir, Log& log) = 0;
 };
 
@@ -161,6 +165,8 @@ public:
     QString version() override { return _version; }
     const std::vector<unsigned char> &icon() override { return _icon; }
     bool supported() override { return _supported; }
+    // the renderer drives a web page that needs an event loop of its own
+    bool concurrent() override { return false; }
     void dump(QString outDir, Log& log) override {
         duden::writeDSL(std::filesystem::u8path(path().toStdString()),
                         std::filesystem::u8path(outDir.toStdString()),
@@ -170,8 +176,14 @@ public:
 };
 #endif
 
+struct ConversionStatus {
+    QString text;
+    QString error;
+};
+
 class LSDListModel : public QAbstractListModel {
     std::vector<std::unique_ptr<DictionaryEntry>> _dicts;
+    std::vector<ConversionStatus> _statuses;
     std::vector<QString> _columns;
 public:
     LSDListModel() {
@@ -182,7 +194,8 @@ public:
             "Source",
             "Target",
             "Entries",
-            "Version"
+            "Version",
+            "Status"
         };
     }
     virtual Qt::DropActions supportedDropActions() const {
@@ -196,6 +209,7 @@ public:
     virtual bool dropMimeData(const QMimeData *data, Qt::DropAction action, int, int, const QModelIndex &parent) {
         beginRemoveRows(parent, 0, _dicts.size() - 1);
         _dicts.clear();
+        _statuses.clear();
         endRemoveRows();
         if (action == Qt::IgnoreAction)
             return true;
@@ -224,6 +238,7 @@ public:
                 QMessageBox::warning(nullptr, QString(e.what()), path);
             }
         }
+        _statuses.resize(_dicts.size());
         beginInsertRows(parent, 0, _dicts.size() - 1);
         endInsertRows();
         return true;
@@ -237,6 +252,14 @@ public:
     std::vector<std::unique_ptr<DictionaryEntry>>& dicts() {
         return _dicts;
     }
+    void setStatus(DictionaryEntry* dict, QString text, QString error = {}) {
+        auto it = std::find_if(begin(_dicts), end(_dicts), [&](auto& d) { return d.get() == dict; });
+        if (it == end(_dicts))
+            return;
+        int row = it - begin(_dicts);
+        _statuses[row] = {text, error};
+        emit dataChanged(index(row, 0), index(row, _columns.size() - 1));
+    }
     virtual QVariant data(const QModelIndex &index, int role) const {
         auto& dict = _dicts.at(index.row());
         if (role == Qt::DecorationRole && index.column() == 0) {
@@ -246,10 +269,15 @@ public:
             return QVariant(icon);
         }
 
-        if (role == Qt::BackgroundRole && !dict->supported()) {
+        auto& status = _statuses.at(index.row());
+        if (role == Qt::BackgroundRole && (!dict->supported() || !status.error.isEmpty())) {
             return QColor("#fbe3e4");
         }
 
+        if (role == Qt::ToolTipRole && !status.error.isEmpty()) {
+            return status.error;
+        }
+
         if (role == Qt::DisplayRole) {
             switch(index.column()) {
             case 1: return dict->fileName();
@@ -258,6 +286,7 @@ public:
             case 4: return dict->target();
             case 5: return dict->entries();
             case 6: return dict->version();
+            case 7: return status.text;
             }
         }
         return QVariant();
@@ -275,47 +304,85 @@ public:
     }
 };
 
-class ConvertWithProgress : public QObject, public Log {
-    Q_OBJECT
-    std::vector<DictionaryEntry*> _dicts;
-    QString _outDir;
+class ConvertWithProgress;
 
-signals:
-    void statusUpdated(int percent);
-    void progressReset(QString name);
-    void nextDictionary(QString name);
-    void error(QString dict, QString message);
-    void done();
+// Forwards the progress of one dictionary, tagged with its index.
+class DictionaryProgress : public Log {
+    ConvertWithProgress* _converter;
+    int _index;
+    std::string _name;
 
 protected:
     void reportLog(std::string, bool) override { }
+    void reportProgress(int percentage) override;
+    void reportProgressReset(std::string name) override { _name = name; }
 
-    void reportProgress(int percentage) override {
-        emit statusUpdated(percentage);
-    }
+public:
+    DictionaryProgress(ConvertWithProgress* converter, int index)
+        : _converter(converter), _index(index) { }
+};
 
-    void reportProgressReset(std::string name) override {
-        emit progressReset(QString::fromStdString(name));
-    }
+// Converts the dictionaries on a pool of threads sized to the number of
+// cores, largest first. A failed dictionary is reported on its own and
+// doesn't stop the others.
+class ConvertWithProgress : public QObject {
+    Q_OBJECT
+    std::vector<DictionaryEntry*> _dicts;
+    QString _outDir;
+
+signals:
+    void statusUpdated(int index, QString name, int percent);
+    void started(int index);
+    void finished(int index);
+    void error(int index, QString message);
+    void done();
 
 public:
     ConvertWithProgress(std::vector<DictionaryEntry*> dicts, QString outDir)
         : _dicts(dicts), _outDir(outDir) { }
+
+    void convert(int index) {
+        emit started(index);
+        DictionaryProgress progress(this, index);
+        try {
+            _dicts[index]->dump(_outDir, progress);
+            emit finished(index);
+        } catch (std::exception& e) {
+            emit error(index, e.what());
+        } catch (...) {
+            // would terminate the application on a pool thread
+            emit error(index, "unknown error");
+        }
+    }
+
 public slots:
     void start() {
-        for (DictionaryEntry* dict : _dicts) {
-            emit nextDictionary(dict->fileName());
-            try {
-                dict->dump(_outDir, *this);
-            } catch (std::exception& e) {
-                emit error(dict->fileName(), e.what());
-                return;
+        std::vector<int> order(_dicts.size());
+        std::iota(begin(order), end(order), 0);
+        std::stable_sort(begin(order), end(order), [&](int a, int b) {
+            return QFileInfo(_dicts[a]->path()).size() > QFileInfo(_dicts[b]->path()).size();
+        });
+        QThreadPool pool;
+        pool.setMaxThreadCount(QThread::idealThreadCount());
+        for (int index : order) {
+            if (_dicts[index]->concurrent()) {
+                pool.start([=, this] { convert(index); });
+            }
+        }
+        for (int index : order) {
+            if (!_dicts[index]->concurrent()) {
+                convert(index);
             }
         }
+        pool.waitForDone();
         emit done();
     }
 };
 
+void DictionaryProgress::reportProgress(int percentage) {
+    emit _converter->statusUpdated(_index, QString::fromStdString(_name), percentage);
+}
+
 void MainWindow::updateConvertSelected() {
     int count = _tableView->selectionModel()->selectedRows().size();
     _convertSelectedButton->setEnabled(count > 0);
@@ -347,40 +414,47 @@ void MainWindow::convert(bool selectedOnly) {
             "Some dictionaries in the list aren't supported and wont be decompiled.");
     }
 
-    _progress->setMaximum(dicts.size() + 1);
+    _progress->setMaximum(dicts.size());
     _progress->setValue(0);
+    for (auto dict : dicts) {
+        _model->setStatus(dict, "queued");
+    }
+    auto failures = std::make_shared<QStringList>();
+    auto updateTotal = [=, this] {
+        _progress->setValue(_progress->value() + 1);
+        _currentDict->setText(QString("%1 of %2 converted").arg(_progress->value()).arg(dicts.size()));
+    };
 
     auto thread = new QThread();
     auto converter = new ConvertWithProgress(dicts, dir);
     converter->moveToThread(thread);
 
-    connect(converter, &ConvertWithProgress::statusUpdated, this, [this](int percentage) {
-        _dictProgress->setValue(percentage);
+    connect(converter, &ConvertWithProgress::started, this, [=, this](int index) {
+        _model->setStatus(dicts[index], "started");
     });
-    connect(converter, &ConvertWithProgress::progressReset, this, [this](QString name) {
-        _progressName->setText("processing " + name);
+    connect(converter, &ConvertWithProgress::statusUpdated, this, [=, this](int index, QString name, int percentage) {
+        _model->setStatus(dicts[index], QString("%1 %2%").arg(name).arg(percentage));
     });
-    connect(converter, &ConvertWithProgress::nextDictionary, this, [this](QString name) {
-        _progress->setValue(_progress->value() + 1);
-        _dictProgress->setValue(0);
-        _currentDict->setText(name + "...");
+    connect(converter, &ConvertWithProgress::finished, this, [=, this](int index) {
+        _model->setStatus(dicts[index], "done");
+        updateTotal();
+    });
+    connect(converter, &ConvertWithProgress::error, this, [=, this](int index, QString message) {
+        _model->setStatus(dicts[index], "failed", message);
+        failures->append(QString("%1: %2").arg(dicts[index]->fileName(), message));
+        updateTotal();
     });
-    auto enable = [this] {
+    connect(converter, &ConvertWithProgress::done, this, [=, this] {
         _tableView->setEnabled(true);
         _convertAllButton->setEnabled(true);
         updateConvertSelected();
-    };
-    connect(converter, &ConvertWithProgress::done, this, [=, this] {
-        _currentDict->setText("");
-        _progressName->setText("");
-        _progress->setValue(_progress->maximum());
-        enable();
-    });
-    connect(converter, &ConvertWithProgress::error, this, [=, this](QString dict, QString message) {
-        QMessageBox::critical(this, "An error occurred",
-            QString("Decompiling of %1 failed with error\n%2").arg(dict, message));
-        _progress->setValue(0);
-        enable();
+        if (!failures->isEmpty()) {
+            QMessageBox::critical(this, "An error occurred",
+                QString("Decompiling of %1 of %2 dictionaries failed\n%3")
+                    .arg(failures->size())
+                    .arg(dicts.size())
+                    .arg(failures->join("\n")));
+        }
     });
 
     _tableView->setEnabled(false);
@@ -389,6 +463,7 @@ void MainWindow::convert(bool selectedOnly) {
 
     connect(thread, &QThread::started, converter, &ConvertWithProgress::start);
     connect(converter, &ConvertWithProgress::done, converter, &QObject::deleteLater);
+    connect(converter, &ConvertWithProgress::done, thread, &QThread::quit);
     connect(thread, &QThread::finished, thread, &QObject::deleteLater);
     thread->start();
 }
@@ -413,8 +488,6 @@ MainWindow::MainWindow(QWidget *parent)
     rightPanelWidget->setLayout(vbox);
     vbox->addLayout(form);
     vbox->addWidget(_currentDict = new QLabel(this));
-    vbox->addWidget(_progressName = new QLabel(this));
-    vbox->addWidget(_dictProgress = new QProgressBar(this));
     vbox->addWidget(_progress = new QProgressBar(this));
     vbox->addWidget(_convertAllButton = new QPushButton("Convert all"));
     vbox->addWidget(_convertSelectedButton = new QPushButton("Convert selected"));
@@ -15,9 +15,7 @@ class MainWindow : public QMainWindow {
     QPushButton* _convertSelectedButton;
     QTableView* _tableView;
     QProgressBar* _progress;
-    QProgressBar* _dictProgress;
     QLabel* _currentDict;
-    QLabel* _progressName;
     QSortFilterProxyModel* _proxyModel;
     QLabel* _selectedLabel;
     void convert(bool selectedOnly);
@@ -5,6 +5,7 @@
 #include "common/version.h"
 #include "common/WavWriter.h"
 #include "lingvo/LSAReader.h"
+#include "lingvo/LookupServer.h"
 #include "lingvo/lsd.h"
 #include "lingvo/tools.h"
 #include "lingvo/WriteDsl.h"
@@ -28,7 +29,12 @@
 #include <fmt/format.h>
 #include <fmt/ostream.h>
 
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <tuple>
 #include <map>
@@ -47,9 +53,11 @@ int parseLSD(std::filesystem::path lsdPath,
              int sourceFilter,
              int targetFilter,
              bool dumb,
+             unsigned threads,
+             int zipLevel,
              Log& log)
 {
-    common::FileStream ras(lsdPath);
+    common::MappedFileStream ras(lsdPath);
     common::BitStreamAdapter bstr(&ras);
     LSDDictionary reader(&bstr);
     LSDHeader header = reader.header();
@@ -80,12 +88,26 @@ int parseLSD(std::filesystem::path lsdPath,
     }
 
     if (!outputPath.empty()) {
-        lingvo::writeDSL(&reader, lsdPath.filename(), outputPath, dumb, log);
+        lingvo::writeDSL(&reader, lsdPath.filename(), outputPath, dumb, log, threads, zipLevel);
     }
 
     return 0;
 }
 
+int serveLookups(std::vector<std::string> const& lsdPaths,
+                 unsigned threads,
+                 size_t articleCacheBudget,
+                 bool useIndex,
+                 Log& log)
+{
+    LookupServer server(threads, articleCacheBudget);
+    for (auto& path : lsdPaths) {
+        server.addDictionary(std::filesystem::u8path(path), useIndex, log);
+    }
+    server.serve(std::cin, std::cout);
+    return 0;
+}
+
 #ifdef ENABLE_DUDEN
 int printDudenInfo(std::filesystem::path infPath, Log& log) {
     duden::FileSystem fs(infPath.parent_path());
@@ -115,7 +137,7 @@ int printDudenInfo(std::filesystem::path infPath, Log& log) {
     return 0;
 }
 
-int parseDuden(std::filesystem::path infPath, std::filesystem::path outputPath, Log& log) {
+int parseDuden(std::filesystem::path infPath, std::filesystem::path outputPath, int zipLevel, Log& log) {
     common::FileStream infStream(infPath);
     duden::FileSystem fs(infPath.parent_path());
     auto infs = duden::parseInfFile(&infStream, &fs);
@@ -127,7 +149,7 @@ int parseDuden(std::filesystem::path infPath, std::filesystem::path outputPath,
         }
 
         if (!outputPath.empty()) {
-            duden::writeDSL(infPath, outputPath, i, log);
+            duden::writeDSL(infPath, outputPath, i, log, zipLevel);
         }
     }
 
@@ -140,7 +162,7 @@ void decodeBofIdx(std::filesystem::path bofPath,
                   bool dudenEncoding,
                   std::filesystem::path output) {
     common::FileStream fIdx(idxPath);
-    auto fBof = std::make_shared<common::FileStream>(bofPath);
+    auto fBof = std::make_shared<common::MappedFileStream>(bofPath);
     duden::Archive archive(&fIdx, fBof);
     std::vector<char> vec;
 
@@ -256,6 +278,7 @@ void decodeAdp(std::filesystem::path adpPath, std::filesystem::path outputPath)
 #endif
 
 class ConsoleLog : public Log {
+    FILE* _out;
     bool _verbose;
     bool _lastProgress = false;
     std::string _bar;
@@ -266,9 +289,9 @@ protected:
     void reportLog(std::string line, bool verbose) override {
         if (_verbose || !verbose) {
             if (_lastProgress) {
-                fmt::print("\n");
+                fmt::print(_out, "\n");
             }
-            fmt::print("{}\n", line);
+            fmt::print(_out, "{}\n", line);
             _lastProgress = false;
         }
     }
@@ -276,34 +299,192 @@ protected:
     void reportProgress(int percentage) override {
         int left = static_cast<int>(percentage / 100.f * _bar.size());
         int right = _bar.size() - left;
-        fmt::print("\r{} {:3d}% [{}{}]",
+        fmt::print(_out, "\r{} {:3d}% [{}{}]",
                    _progressName,
                    percentage,
                    std::string_view(_bar).substr(0, left),
                    std::string_view(_empty).substr(0, right));
         if (percentage == 100) {
-            fmt::print("\n");
-            std::fflush(stdout);
+            fmt::print(_out, "\n");
+            std::fflush(_out);
             _lastProgress = false;
         } else {
-            std::fflush(stdout);
+            std::fflush(_out);
             _lastProgress = true;
         }
     }
 
     void reportProgressReset(std::string name) override {
         if (_lastProgress) {
-            fmt::print("\n");
-            std::fflush(stdout);
+            fmt::print(_out, "\n");
+            std::fflush(_out);
         }
         _progressName = name;
         _lastProgress = false;
     }
 
 public:
-    ConsoleLog(bool verbose) : _verbose(verbose), _bar(50, '='), _empty(_bar.size(), ' ') {}
+    ConsoleLog(bool verbose, FILE* out = stdout)
+        : _out(out), _verbose(verbose), _bar(50, '='), _empty(_bar.size(), ' ') {}
+};
+
+// Prefixes the lines of every job with its dictionary and combines their
+// progress into a single bar, each job weighted by the size of its file.
+class BatchProgress {
+    Log& _log;
+    std::mutex _mutex;
+    std::vector<std::string> _names;
+    std::vector<uintmax_t> _sizes;
+    std::vector<int> _percentages;
+    uintmax_t _totalSize = 0;
+    int _reported = 0;
+
+public:
+    BatchProgress(Log& log,
+                  std::vector<std::filesystem::path> const& paths,
+                  std::vector<uintmax_t> const& sizes)
+        : _log(log), _percentages(paths.size())
+    {
+        for (size_t i = 0; i < paths.size(); ++i) {
+            _names.push_back(paths[i].filename().u8string());
+            _sizes.push_back(std::max<uintmax_t>(sizes[i], 1));
+            _totalSize += _sizes.back();
+        }
+        _log.resetProgress("dictionaries", 100);
+    }
+
+    void line(size_t job, std::string const& line, bool verbose) {
+        std::lock_guard lock(_mutex);
+        if (verbose) {
+            _log.verbose("[{}] {}", _names[job], line);
+        } else {
+            _log.regular("[{}] {}", _names[job], line);
+        }
+    }
+
+    // a job goes through a few progress phases, the bar never moves back
+    void progress(size_t job, int percentage) {
+        std::lock_guard lock(_mutex);
+        _percentages[job] = percentage;
+        double done = 0;
+        for (size_t i = 0; i < _sizes.size(); ++i) {
+            done += _sizes[i] * (_percentages[i] / 100.);
+        }
+        auto total = static_cast<int>(done * 100 / _totalSize);
+        while (_reported < std::min(total, 100)) {
+            _log.advance();
+            _reported++;
+        }
+    }
+};
+
+class JobLog : public Log {
+    BatchProgress& _batch;
+    size_t _job;
+
+protected:
+    void reportLog(std::string line, bool verbose) override {
+        _batch.line(_job, line, verbose);
+    }
+
+    void reportProgress(int percentage) override {
+        _batch.progress(_job, percentage);
+    }
+
+    void reportProgressReset(std::string) override { }
+
+public:
+    JobLog(BatchProgress& batch, size_t job) : _batch(batch), _job(job) {}
 };
 
+// Only the header is read to apply the language filters, the dictionaries
+// are converted from the largest down, so that a large one isn't left
+// running alone at the end.
+int convertDirectory(std::filesystem::path inputDir,
+                     std::filesystem::path outputPath,
+                     int sourceFilter,
+                     int targetFilter,
+                     bool dumb,
+                     unsigned jobs,
+                     unsigned threads,
+                     int zipLevel,
+                     Log& log)
+{
+    // a file that can't be probed counts as a failed dictionary, the rest of
+    // the directory is still converted
+    std::vector<std::pair<uintmax_t, std::filesystem::path>> found;
+    unsigned unreadable = 0;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(inputDir, options)) {
+        auto ext = entry.path().extension().u8string();
+        std::transform(begin(ext), end(ext), begin(ext), [](char c) {
+            return std::tolower(static_cast<unsigned char>(c));
+        });
+        try {
+            if (!entry.is_regular_file() || ext != ".lsd")
+                continue;
+            LSDHeader header{};
+            openForReading(entry.path()).read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (std::string_view(header.magic, 6) != "LingVo") {
+                log.verbose("skipping {}: not an LSD file", entry.path().u8string());
+                continue;
+            }
+            if ((sourceFilter != -1 && sourceFilter != header.sourceLanguage) ||
+                (targetFilter != -1 && targetFilter != header.targetLanguage)) {
+                log.verbose("skipping {}: filtered out by language", entry.path().u8string());
+                continue;
+            }
+            found.emplace_back(entry.file_size(), entry.path());
+        } catch (std::exception& exc) {
+            log.regular("can't read {}: {}", entry.path().u8string(), exc.what());
+            unreadable++;
+        }
+    }
+    std::stable_sort(begin(found), end(found), [](auto& a, auto& b) {
+        return a.first > b.first;
+    });
+    std::vector<std::filesystem::path> paths;
+    std::vector<uintmax_t> sizes;
+    for (auto& [size, path] : found) {
+        sizes.push_back(size);
+        paths.push_back(std::move(path));
+    }
+    log.regular("converting {} dictionaries on {} threads", paths.size(), jobs);
+    if (paths.empty())
+        return unreadable ? 1 : 0;
+
+    BatchProgress batch(log, paths, sizes);
+    std::atomic<size_t> next = 0;
+    std::atomic<unsigned> failed = unreadable;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, paths.size()); ++i) {
+        workers.emplace_back([&] {
+            for (size_t job; (job = next++) < paths.size();) {
+                JobLog jobLog(batch, job);
+                try {
+                    auto jobOutput = outputPath;
+                    if (!outputPath.empty()) {
+                        jobOutput /= std::filesystem::relative(paths[job].parent_path(), inputDir);
+                        std::filesystem::create_directories(jobOutput);
+                    }
+                    if (parseLSD(paths[job], jobOutput, -1, -1, dumb, threads, zipLevel, jobLog)) {
+                        failed++;
+                    }
+                } catch (std::exception& exc) {
+                    jobLog.regular("an error occurred while processing dictionary: {}", exc.what());
+                    failed++;
+                }
+                batch.progress(job, 100);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    log.regular("converted {} dictionaries, {} failed", paths.size() + unreadable - failed, failed.load());
+    return failed ? 1 : 0;
+}
+
 int lsd2dsl_gui(int argc, char* argv[]) {
     QApplication app(argc, argv);
     MainWindow w;
@@ -318,10 +499,14 @@ int lsd2dsl_main(int argc, char* argv[]) {
     QApplication a(argc, argv);
     bool dudenEncoding, dudenPrintInfo;
 #endif
-    std::string lsdPathStr, lsaPathStr, dudenPathStr, outputPathStr;
+    std::string lsdPathStr, lsaPathStr, dudenPathStr, outputPathStr, inputDirStr;
     std::string bofPathStr, idxPathStr, fsiPathStr, hicPathStr, adpPathStr, textPathStr;
-    int sourceFilter = -1, targetFilter = -1;
-    bool isDumb, verbose;
+    std::vector<std::string> servePathStrs;
+    int sourceFilter = -1, targetFilter = -1, zipLevel = -1;
+    unsigned threads = 1;
+    unsigned jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned articleCacheMb = 64;
+    bool isDumb, verbose, useIndex;
     po::options_description console_desc("Allowed options");
     try {
         console_desc.add_options()
@@ -331,6 +516,12 @@ int lsd2dsl_main(int argc, char* argv[]) {
             ("duden", po::value(&dudenPathStr), "Duden dictionary to decode (.inf file)")
 #endif
             ("lsa", po::value(&lsaPathStr), "LSA sound archive to decode")
+            ("input-dir", po::value(&inputDirStr),
+                "decode every LSD dictionary in this directory and its subdirectories, "
+                "keeping their relative paths in the output directory")
+            ("jobs", po::value<unsigned>(&jobs),
+                "number of dictionaries from --input-dir decoded at once "
+                "(default: the number of cores)")
             ("source-filter", po::value<int>(&sourceFilter),
                 "ignore dictionaries with source language != source-filter")
             ("target-filter", po::value<int>(&targetFilter),
@@ -339,6 +530,21 @@ int lsd2dsl_main(int argc, char* argv[]) {
             ("out", po::value(&outputPathStr), "output directory")
             ("dumb", "don't combine variant headings and headings "
                      "referencing the same article")
+            ("threads", po::value<unsigned>(&threads),
+                "number of threads decoding LSD articles or answering lookups (default 1)")
+            ("zip-level", po::value<int>(&zipLevel),
+                "compression level of the .files.zip archives, from 0 (store) to 9, "
+                "pictures and sounds that are compressed already are always stored "
+                "(default -1, zlib's default level)")
+            ("serve", po::value(&servePathStrs)->multitoken(),
+                "keep these LSD dictionaries open and answer JSON lookups, "
+                "one per line on stdin, with one response per line on stdout "
+                "(Duden dictionaries can't be served)")
+            ("article-cache", po::value<unsigned>(&articleCacheMb),
+                "megabytes of decoded articles to cache per served dictionary (default 64)")
+            ("index", "look the served headings up in a sidecar index (.lsd.idx) "
+                      "next to each dictionary, written if missing or outdated, "
+                      "a dictionary whose index can't be written is served without one")
             ("verbose", "verbose logging")
             ("version", "print version")
             ;
@@ -371,17 +577,31 @@ int lsd2dsl_main(int argc, char* argv[]) {
         }
         isDumb = console_vm.count("dumb");
         verbose = console_vm.count("verbose");
+        useIndex = console_vm.count("index");
 #ifdef ENABLE_DUDEN
         dudenEncoding = console_vm.count("duden-utf");
         dudenPrintInfo = console_vm.count("duden-info");
 #endif
         po::notify(console_vm);
+        if (zipLevel < -1 || zipLevel > 9)
+            throw std::runtime_error("zip-level must be between -1 and 9");
     } catch(std::exception& e) {
         fmt::print("can't parse program options:\n{}\n\n{}", e.what(), fmt::streamed(console_desc));
         return 1;
     }
 
-    if (lsdPathStr.empty() && lsaPathStr.empty() && dudenPathStr.empty() && bofPathStr.empty() &&
+    if (!servePathStrs.empty()) {
+        // the responses go to stdout
+        ConsoleLog log(verbose, stderr);
+        try {
+            return serveLookups(servePathStrs, threads, size_t(articleCacheMb) << 20, useIndex, log);
+        } catch (std::exception& exc) {
+            fmt::print(stderr, "can't serve the dictionaries: {}\n", exc.what());
+            return 1;
+        }
+    }
+
+    if (lsdPathStr.empty() && lsaPathStr.empty() && dudenPathStr.empty() && inputDirStr.empty() && bofPathStr.empty() &&
         textPathStr.empty() && hicPathStr.empty() && fsiPathStr.empty() && adpPathStr.empty()) {
         fmt::print("{}", fmt::streamed(console_desc));
         return 0;
@@ -389,6 +609,7 @@ int lsd2dsl_main(int argc, char* argv[]) {
 
     const auto lsdPath = std::filesystem::u8path(lsdPathStr);
     const auto lsaPath = std::filesystem::u8path(lsaPathStr);
+    const auto inputDir = std::filesystem::u8path(inputDirStr);
     const auto dudenPath = std::filesystem::u8path(dudenPathStr);
     const auto bofPath = std::filesystem::u8path(bofPathStr);
     const auto textPath = std::filesystem::u8path(textPathStr);
@@ -411,17 +632,31 @@ int lsd2dsl_main(int argc, char* argv[]) {
                      sourceFilter,
                      targetFilter,
                      isDumb,
+                     threads,
+                     zipLevel,
                      log);
         }
         if (!lsaPath.empty()) {
             decodeLSA(lsaPath, outputPath, log);
         }
+        if (!inputDir.empty()) {
+            if (convertDirectory(inputDir,
+                                 outputPath,
+                                 sourceFilter,
+                                 targetFilter,
+                                 isDumb,
+                                 std::max(jobs, 1u),
+                                 threads,
+                                 zipLevel,
+                                 log))
+                return 1;
+        }
 #ifdef ENABLE_DUDEN
         if (!dudenPath.empty()) {
             if (dudenPrintInfo) {
                 return printDudenInfo(dudenPath, log);
             }
-            parseDuden(dudenPath, outputPath, log);
+            parseDuden(dudenPath, outputPath, zipLevel, log);
         }
         if (!bofPath.empty() && !idxPath.empty()) {
             decodeBofIdx(bofPath, idxPath, fsiPath, dudenEncoding, outputPath);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <concepts>
+#include <cstring>
+#include <span>
+#include <stdint.h>
+
+namespace common {
+
+extern const unsigned char xor_pad[256];
+
+// What the decoders need from a bit source. IBitStream satisfies it through
+// virtual calls, MemoryBitReader satisfies it with everything inlined.
+template <class T>
+concept BitReader = requires(T& reader, unsigned len, void* dest) {
+    { reader.read(len) } -> std::convertible_to<unsigned>;
+    { reader.peek(len) } -> std::convertible_to<unsigned>;
+    reader.skip(len);
+    { reader.readSome(dest, len) } -> std::convertible_to<unsigned>;
+    reader.seek(len);
+    { reader.tell() } -> std::convertible_to<unsigned>;
+    reader.toNearestByte();
+};
+
+// Non-virtual counterpart of BitStreamAdapter (and XoringStreamAdapter when
+// Xoring is set) over a buffer that is already in memory.
+template <bool Xoring>
+class BasicMemoryBitReader {
+    const uint8_t* _data;
+    unsigned _size;
+    unsigned _pos; // next byte to go into _acc
+    uint64_t _acc = 0; // unread bits are at the top
+    unsigned _accBits = 0;
+    unsigned char _key = 0x7f;
+
+    uint8_t nextByte() {
+        uint8_t byte = _data[_pos++];
+        if constexpr (Xoring) {
+            uint8_t plain = byte ^ _key;
+            _key = xor_pad[byte];
+            return plain;
+        }
+        return byte;
+    }
+
+    void refill() {
+        if constexpr (!Xoring) {
+            if (_size - _pos >= 8) {
+                uint64_t word = 0;
+                for (int i = 0; i < 8; ++i) {
+                    word = (word << 8) | _data[_pos + i];
+                }
+                _acc |= word >> _accBits;
+                auto bytes = (64 - _accBits) / 8;
+                _pos += bytes;
+                _accBits += bytes * 8;
+                return;
+            }
+        }
+        while (_accBits <= 56 && _pos < _size) {
+            _acc |= uint64_t(nextByte()) << (56 - _accBits);
+            _accBits += 8;
+        }
+    }
+
+public:
+    BasicMemoryBitReader(std::span<const uint8_t> data, unsigned pos = 0)
+        : _data(data.data()), _size(data.size()), _pos(std::min<unsigned>(pos, data.size())) { }
+
+    unsigned read(unsigned count) {
+        unsigned res = peek(count);
+        skip(count);
+        return res;
+    }
+
+    unsigned peek(unsigned count) {
+        assert(count <= 32);
+        if (count == 0)
+            return 0;
+        if (_accBits < count) {
+            refill();
+        }
+        return _acc >> (64 - count);
+    }
+
+    void skip(unsigned count) {
+        assert(count <= 32);
+        _acc <<= count;
+        _accBits = _accBits > count ? _accBits - count : 0;
+    }
+
+    unsigned readSome(void* dest, unsigned byteCount) {
+        toNearestByte();
+        auto bytes = static_cast<uint8_t*>(dest);
+        unsigned done = 0;
+        while (done < byteCount && _accBits) {
+            bytes[done++] = _acc >> 56;
+            _acc <<= 8;
+            _accBits -= 8;
+        }
+        if (done == byteCount)
+            return done;
+        _acc = 0;
+        auto chunk = std::min(byteCount - done, _size - _pos);
+        if constexpr (Xoring) {
+            for (unsigned i = 0; i < chunk; ++i) {
+                bytes[done + i] = nextByte();
+            }
+        } else {
+            memcpy(bytes + done, _data + _pos, chunk);
+            _pos += chunk;
+        }
+        return done + chunk;
+    }
+
+    // past the end reads nothing, as MappedFileStream does
+    void seek(unsigned pos) {
+        _pos = std::min(pos, _size);
+        _acc = 0;
+        _accBits = 0;
+        _key = 0x7f;
+    }
+
+    unsigned tell() const {
+        return _pos - _accBits / 8;
+    }
+
+    void toNearestByte() {
+        auto partial = _accBits % 8;
+        _acc <<= partial;
+        _accBits -= partial;
+    }
+
+    std::span<const uint8_t> span() const {
+        return {_data, _size};
+    }
+};
+
+using MemoryBitReader = BasicMemoryBitReader<false>;
+using XoringMemoryBitReader = BasicMemoryBitReader<true>;
+
+}
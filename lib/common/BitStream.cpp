@@ -1,60 +1,179 @@
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 
 #include "common/CommonTools.h"
 
-#include <bitset>
+#include <fmt/format.h>
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <stdexcept>
+#include <limits>
 #include <assert.h>
 #include <stdint.h>
-#include <functional>
+#include <algorithm>
 #include <cstring>
 
 namespace common {
 
-bool advance(unsigned& bitPos) {
-    bitPos = (bitPos + 1) % 8;
-    return bitPos == 0;
-}
+constexpr unsigned bitStreamBufferSize = 8 * 1024;
+constexpr unsigned bitStreamMinFill = 64;
 
-unsigned BitStreamAdapter::readBit() {
-    if (_bitPos == 0) {
-        readSome(&_cache, 1);
+static uint64_t loadBigEndian64(const uint8_t* ptr) {
+    uint64_t res = 0;
+    for (int i = 0; i < 8; ++i) {
+        res = (res << 8) | ptr[i];
     }
-    std::bitset<8> bset(_cache);
-    unsigned bit = bset[7 - _bitPos];
-    advance(_bitPos);
-    return bit;
+    return res;
 }
 
 BitStreamAdapter::BitStreamAdapter(IRandomAccessStream* ras)
-    : _ras(ras), _bitPos(0) { }
+    : _buf(bitStreamBufferSize), _base(ras->tell()), _fillSize(bitStreamMinFill), _ras(ras) { }
+
+void BitStreamAdapter::attach(IRandomAccessStream* ras) {
+    _ras = ras;
+    _base = ras->tell();
+    _bufPos = _bufEnd = 0;
+    _acc = 0;
+    _accBits = 0;
+    _fillSize = bitStreamMinFill;
+}
+
+unsigned BitStreamAdapter::fetch(void* dest, unsigned byteCount) {
+    return _ras->readSome(dest, byteCount);
+}
+
+// Random access (one article, one page) is common, so the fill size starts
+// small after a seek and doubles while reading stays sequential.
+bool BitStreamAdapter::fillBuffer() {
+    _base += _bufEnd;
+    _bufPos = _bufEnd = 0;
+    if (_ras->tell() != _base) {
+        _ras->seek(_base);
+    }
+    _bufEnd = fetch(_buf.data(), _fillSize);
+    _fillSize = std::min<unsigned>(_fillSize * 2, _buf.size());
+    return _bufEnd != 0;
+}
+
+void BitStreamAdapter::refill() {
+    while (_accBits <= 56) {
+        if (_bufEnd - _bufPos >= 8) {
+            // the bits below _accBits after the shift are the true next bits,
+            // the next refill ors the same values over them
+            _acc |= loadBigEndian64(&_buf[_bufPos]) >> _accBits;
+            auto bytes = (64 - _accBits) / 8;
+            _bufPos += bytes;
+            _accBits += bytes * 8;
+            return;
+        }
+        if (_bufPos == _bufEnd && !fillBuffer())
+            return;
+        _acc |= uint64_t(_buf[_bufPos++]) << (56 - _accBits);
+        _accBits += 8;
+    }
+}
+
+void BitStreamAdapter::discard() {
+    _base = tell();
+    _bufPos = _bufEnd = 0;
+    _acc = 0;
+    _accBits = 0;
+    _fillSize = bitStreamMinFill;
+}
 
 unsigned BitStreamAdapter::read(unsigned count) {
+    unsigned res = peek(count);
+    skip(count);
+    return res;
+}
+
+unsigned BitStreamAdapter::peek(unsigned count) {
     assert(count <= sizeof(unsigned) * 8);
-    unsigned res = 0;
-    while(count) {
-        res <<= 1;
-        res |= readBit();
-        count--;
+    if (count == 0)
+        return 0;
+    if (_accBits < count) {
+        refill();
     }
-    return res;
+    return _acc >> (64 - count);
+}
+
+void BitStreamAdapter::skip(unsigned count) {
+    assert(count <= sizeof(unsigned) * 8);
+    _acc <<= count;
+    _accBits = _accBits > count ? _accBits - count : 0;
 }
 
 unsigned BitStreamAdapter::readSome(void *dest, unsigned byteCount) {
-    return _ras->readSome(dest, byteCount);
+    toNearestByte();
+    auto bytes = static_cast<uint8_t*>(dest);
+    unsigned done = 0;
+    while (done < byteCount && _accBits) {
+        bytes[done++] = _acc >> 56;
+        _acc <<= 8;
+        _accBits -= 8;
+    }
+    if (done == byteCount)
+        return done;
+    _acc = 0;
+    while (done < byteCount) {
+        if (_bufPos == _bufEnd) {
+            if (byteCount - done >= _buf.size()) {
+                discard();
+                if (_ras->tell() != _base) {
+                    _ras->seek(_base);
+                }
+                auto fetched = fetch(bytes + done, byteCount - done);
+                _base += fetched;
+                done += fetched;
+                break;
+            }
+            if (!fillBuffer())
+                break;
+        }
+        auto chunk = std::min(byteCount - done, _bufEnd - _bufPos);
+        memcpy(bytes + done, &_buf[_bufPos], chunk);
+        _bufPos += chunk;
+        done += chunk;
+    }
+    return done;
 }
 
 void BitStreamAdapter::seek(unsigned pos) {
+    _acc = 0;
+    _accBits = 0;
+    if (pos >= _base && pos <= _base + _bufEnd) {
+        _bufPos = pos - _base;
+        return;
+    }
+    _base = pos;
+    _bufPos = _bufEnd = 0;
+    _fillSize = bitStreamMinFill;
     _ras->seek(pos);
-    _bitPos = 0;
 }
 
 void BitStreamAdapter::toNearestByte() {
-    _bitPos = 0;
+    auto partial = _accBits % 8;
+    _acc <<= partial;
+    _accBits -= partial;
 }
 
 unsigned BitStreamAdapter::tell() {
-    return _ras->tell();
+    return _base + _bufPos - _accBits / 8;
+}
+
+std::span<const uint8_t> BitStreamAdapter::span() {
+    return _ras->span();
 }
 
 InMemoryStream::InMemoryStream(const void *buf, unsigned size)
@@ -76,10 +195,18 @@ unsigned InMemoryStream::tell() {
     return _pos;
 }
 
+std::span<const uint8_t> InMemoryStream::span() {
+    return {_buf, _size};
+}
+
+std::span<const uint8_t> IRandomAccessStream::span() {
+    return {};
+}
+
 IRandomAccessStream::~IRandomAccessStream() { }
 IBitStream::~IBitStream() { }
 
-unsigned char xor_pad[256] = {
+const unsigned char xor_pad[256] = {
     0x9C, 0xDF, 0x9B, 0xF3, 0xBE, 0x3A, 0x83, 0xD8,
     0xC9, 0xF5, 0x50, 0x98, 0x35, 0x4E, 0x7F, 0xBB,
     0x89, 0xC7, 0xE9, 0x6B, 0xC4, 0xC8, 0x4F, 0x85,
@@ -117,10 +244,15 @@ unsigned char xor_pad[256] = {
 XoringStreamAdapter::XoringStreamAdapter(IRandomAccessStream* ras)
     : BitStreamAdapter(ras), _key(0x7f) { }
 
-unsigned XoringStreamAdapter::readSome(void *dest, unsigned byteCount) {
-    unsigned bytesRead = BitStreamAdapter::readSome(dest, byteCount);
+void XoringStreamAdapter::attach(IRandomAccessStream* ras) {
+    BitStreamAdapter::attach(ras);
+    _key = 0x7f;
+}
+
+unsigned XoringStreamAdapter::fetch(void *dest, unsigned byteCount) {
+    unsigned bytesRead = BitStreamAdapter::fetch(dest, byteCount);
     auto bytes = static_cast<unsigned char*>(dest);
-    for (unsigned i = 0; i < byteCount; ++i) {
+    for (unsigned i = 0; i < bytesRead; ++i) {
         unsigned char byte = bytes[i];
         bytes[i] ^= _key;
         _key = xor_pad[byte];
@@ -129,10 +261,16 @@ unsigned XoringStreamAdapter::readSome(void *dest, unsigned byteCount) {
 }
 
 void XoringStreamAdapter::seek(unsigned pos) {
+    // the key depends on every byte since the last seek, nothing buffered is reusable
+    discard();
     BitStreamAdapter::seek(pos);
     _key = 0x7f;
 }
 
+std::span<const uint8_t> XoringStreamAdapter::span() {
+    return {};
+}
+
 FileStream::FileStream(std::filesystem::path path)
     : _file(openForReading(path)) { }
 
@@ -145,6 +283,7 @@ unsigned FileStream::readSome(void *dest, unsigned byteCount) {
 
 void FileStream::seek(unsigned pos) {
     if (_pos != pos) {
+        _file.clear();
         _file.seekg(pos);
         _pos = pos;
     }
@@ -154,6 +293,102 @@ unsigned FileStream::tell() {
     return _pos;
 }
 
+MappedFileStream::MappedFileStream(std::filesystem::path path) {
+    auto fail = [&] {
+        throw std::runtime_error(
+            fmt::format("Can't open file for reading: {}", path.u8string()));
+    };
+    // the streams address files with unsigned offsets
+    auto tooLarge = [&] {
+        throw std::runtime_error(
+            fmt::format("File is too large: {}", path.u8string()));
+    };
+#ifdef WIN32
+    auto file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        fail();
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        fail();
+    }
+    if (static_cast<uint64_t>(size.QuadPart) > std::numeric_limits<unsigned>::max()) {
+        CloseHandle(file);
+        tooLarge();
+    }
+    _size = static_cast<unsigned>(size.QuadPart);
+    if (_size) {
+        _mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping) {
+            _data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+    CloseHandle(file);
+    if (_size && !_data) {
+        if (_mapping) {
+            CloseHandle(_mapping);
+        }
+        fail();
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        fail();
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        fail();
+    }
+    if (static_cast<uint64_t>(st.st_size) > std::numeric_limits<unsigned>::max()) {
+        close(fd);
+        tooLarge();
+    }
+    _size = static_cast<unsigned>(st.st_size);
+    if (_size) {
+        auto data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            fail();
+        }
+        _data = static_cast<const uint8_t*>(data);
+    }
+    close(fd);
+#endif
+}
+
+unsigned MappedFileStream::readSome(void* dest, unsigned byteCount) {
+    byteCount = std::min(byteCount, _size - _pos);
+    memcpy(dest, _data + _pos, byteCount);
+    _pos += byteCount;
+    return byteCount;
+}
+
+void MappedFileStream::seek(unsigned pos) {
+    _pos = std::min(pos, _size);
+}
+
+unsigned MappedFileStream::tell() {
+    return _pos;
+}
+
+std::span<const uint8_t> MappedFileStream::span() {
+    return {_data, _size};
+}
+
+MappedFileStream::~MappedFileStream() {
+#ifdef WIN32
+    if (_data) {
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping);
+    }
+#else
+    if (_data) {
+        munmap(const_cast<uint8_t*>(_data), _size);
+    }
+#endif
+}
+
 uint8_t read8(IRandomAccessStream* stream) {
     uint8_t res;
     stream->readSome(&res, sizeof res);
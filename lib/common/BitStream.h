@@ -2,6 +2,8 @@
 
 #include <filesystem>
 #include <fstream>
+#include <span>
+#include <stdint.h>
 #include <vector>
 
 namespace common {
@@ -11,37 +13,61 @@ public:
     virtual unsigned readSome(void* dest, unsigned byteCount) = 0;
     virtual void seek(unsigned pos) = 0;
     virtual unsigned tell() = 0;
+    // the whole stream if it is backed by memory, empty otherwise
+    virtual std::span<const uint8_t> span();
     virtual ~IRandomAccessStream();
 };
 
 class IBitStream : public IRandomAccessStream {
 public:
     virtual unsigned read(unsigned len) = 0;
+    // the next len bits without consuming them, zero past the end
+    virtual unsigned peek(unsigned len) = 0;
+    virtual void skip(unsigned len) = 0;
     virtual void toNearestByte() = 0;
     virtual ~IBitStream();
 };
 
+// Reads bits msb first. Bytes are pulled from the underlying stream in blocks
+// and shifted through a 64-bit accumulator, so a read costs a few shifts
+// instead of a virtual call per byte.
 class BitStreamAdapter : public IBitStream {
+    std::vector<uint8_t> _buf;
+    unsigned _base; // stream position of _buf[0]
+    unsigned _bufPos = 0;
+    unsigned _bufEnd = 0;
+    unsigned _fillSize;
+    uint64_t _acc = 0; // unread bits are at the top
+    unsigned _accBits = 0;
+    bool fillBuffer();
+    void refill();
 protected:
     IRandomAccessStream* _ras;
-    unsigned _bitPos;
-    virtual unsigned readBit();
-    char _cache;
+    virtual unsigned fetch(void* dest, unsigned byteCount);
+    void discard();
 public:
     BitStreamAdapter(IRandomAccessStream* ras);
+    // continues from the current position of ras, keeping the buffer
+    void attach(IRandomAccessStream* ras);
     virtual unsigned read(unsigned len) override;
+    virtual unsigned peek(unsigned len) override;
+    virtual void skip(unsigned len) override;
     virtual unsigned readSome(void* dest, unsigned byteCount) override;
     virtual void seek(unsigned pos) override;
     virtual void toNearestByte() override;
     virtual unsigned tell() override;
+    virtual std::span<const uint8_t> span() override;
 };
 
 class XoringStreamAdapter : public BitStreamAdapter {
     unsigned char _key;
 public:
     XoringStreamAdapter(IRandomAccessStream* bstr);
-    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    void attach(IRandomAccessStream* ras);
     virtual void seek(unsigned pos) override;
+    virtual std::span<const uint8_t> span() override;
+protected:
+    virtual unsigned fetch(void* dest, unsigned byteCount) override;
 };
 
 class InMemoryStream : public IRandomAccessStream {
@@ -53,6 +79,7 @@ public:
     virtual unsigned readSome(void* dest, unsigned byteCount) override;
     virtual void seek(unsigned pos) override;
     virtual unsigned tell() override;
+    virtual std::span<const uint8_t> span() override;
 };
 
 class FileStream : public IRandomAccessStream {
@@ -65,6 +92,26 @@ public:
     virtual unsigned tell();
 };
 
+// Maps the whole file into memory, reads are served from the page cache
+// without going through iostreams.
+class MappedFileStream : public IRandomAccessStream {
+    const uint8_t* _data = nullptr;
+    unsigned _size = 0;
+    unsigned _pos = 0;
+#ifdef WIN32
+    void* _mapping = nullptr;
+#endif
+public:
+    MappedFileStream(std::filesystem::path path);
+    MappedFileStream(MappedFileStream const&) = delete;
+    MappedFileStream& operator=(MappedFileStream const&) = delete;
+    virtual unsigned readSome(void* dest, unsigned byteCount) override;
+    virtual void seek(unsigned pos) override;
+    virtual unsigned tell() override;
+    virtual std::span<const uint8_t> span() override;
+    ~MappedFileStream();
+};
+
 uint8_t read8(IRandomAccessStream* stream);
 uint16_t read16(IRandomAccessStream* stream);
 uint32_t read32(IRandomAccessStream* stream);
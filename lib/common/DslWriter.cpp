@@ -8,9 +8,36 @@
 namespace dsl {
 
     constexpr char _utf16bom[] { (char)0xff, (char)0xfe };
+    constexpr size_t _bufferSize = 1 << 19;
 
-    void Writer::write(const std::u16string& line) {
-        _dsl->write((char*)line.c_str(), 2 * line.length());
+    void Writer::write(std::u16string_view text) {
+        _buffer.append(text);
+        if (_buffer.size() >= _bufferSize) {
+            flush();
+        }
+    }
+
+    void Writer::flush() {
+        if (!_dsl)
+            return;
+        _dsl->write((char*)_buffer.data(), 2 * _buffer.size());
+        _buffer.clear();
+        if (!*_dsl)
+            throw std::runtime_error(
+                fmt::format("Can't write to {}", _dslPath.u8string()));
+    }
+
+    void Writer::discard() {
+        _buffer.clear();
+        _dsl.reset();
+        std::error_code ec;
+        std::filesystem::remove(_dslPath, ec);
+    }
+
+    Writer::~Writer() {
+        try {
+            flush();
+        } catch (...) { }
     }
 
     Writer::Writer(std::filesystem::path outputPath, std::string name) {
@@ -20,6 +47,7 @@ namespace dsl {
             throw std::runtime_error(
                 fmt::format("Can't open file for writing {}", _dslPath.u8string()));
         _dsl->write(_utf16bom, sizeof(_utf16bom));
+        _buffer.reserve(_bufferSize + 4096);
     }
 
     std::filesystem::path Writer::dslFileName() const {
@@ -61,21 +89,24 @@ namespace dsl {
         write(u"\n");
     }
 
-    void Writer::writeHeading(std::u16string heading) {
-        write(heading.c_str());
+    void Writer::writeHeading(std::u16string_view heading) {
+        // a heading ends at its first null, as it always has
+        write(heading.substr(0, heading.find(u'\0')));
         write(u"\n");
     }
 
-    void Writer::writeArticle(std::u16string article) {
-        std::u16string tab = u"\t";
-        write(tab);
-        for (auto ch : article) {
-            _dsl->write((char*)&ch, sizeof(ch));
-            if (ch == u'\n') {
-                write(tab);
-            }
+    // every line of the article is indented, the lines are copied whole
+    void Writer::writeArticle(std::u16string_view article) {
+        write(u"\t");
+        for (;;) {
+            auto newLine = article.find(u'\n');
+            if (newLine == article.npos)
+                break;
+            write(article.substr(0, newLine + 1));
+            write(u"\t");
+            article.remove_prefix(newLine + 1);
         }
-
+        write(article);
         write(u"\n");
     }
 
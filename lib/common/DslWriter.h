@@ -2,6 +2,7 @@
 
 #include "Log.h"
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <string_view>
@@ -10,13 +11,23 @@
 
 namespace dsl {
 
+// The output is collected in a buffer and written in large blocks. Call
+// flush() once everything is written so that a write error is reported, the
+// destructor flushes whatever is left but can only swallow the error.
 class Writer {
     std::unique_ptr<std::ofstream> _dsl;
     std::filesystem::path _dslPath;
-    void write(const std::u16string &line);
+    std::u16string _buffer;
+    void write(std::u16string_view text);
 
 public:
     Writer(std::filesystem::path outputPath, std::string name);
+    Writer(Writer const&) = delete;
+    Writer& operator=(Writer const&) = delete;
+    ~Writer();
+    void flush();
+    // closes and removes the .dsl written so far, nothing is written after it
+    void discard();
     std::filesystem::path dslFileName() const;
     std::filesystem::path dslFilePath() const;
     void setName(std::u16string name);
@@ -24,8 +35,8 @@ public:
     void setLanguage(int source, int target);
     void setIcon(std::vector<uint8_t> icon);
     void writeNewLine();
-    void writeHeading(std::u16string heading);
-    void writeArticle(std::u16string article);
+    void writeHeading(std::u16string_view heading);
+    void writeArticle(std::u16string_view article);
 };
 
 } // namespace dsl
@@ -4,8 +4,10 @@
 #include <fmt/format.h>
 #include <zlib.h>
 
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
+#include <string_view>
 #include <cstring>
 #include <time.h>
 
@@ -54,9 +56,27 @@ zlib_filefunc64_def makeZipFileFunc() {
     return filefunc;
 }
 
-ZipWriter::ZipWriter(std::filesystem::path path) : _path(path) { }
+bool isCompressedMedia(const void* ptr, size_t size) {
+    auto bytes = static_cast<const uint8_t*>(ptr);
+    auto startsWith = [&](std::string_view magic, size_t offset = 0) {
+        return size >= offset + magic.size() && std::memcmp(bytes + offset, magic.data(), magic.size()) == 0;
+    };
+    return startsWith("\xff\xd8\xff")
+        || startsWith("\x89PNG")
+        || startsWith("GIF8")
+        || (startsWith("RIFF") && startsWith("WEBP", 8))
+        || startsWith("OggS")
+        || startsWith("ID3")
+        || startsWith("PK\x03\x04");
+}
+
+ZipWriter::ZipWriter(std::filesystem::path path, int level) : _path(path), _level(level) { }
+
+bool ZipWriter::stores(const void* ptr, size_t size) const {
+    return _level == 0 || isCompressedMedia(ptr, size);
+}
 
-void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
+void ZipWriter::openEntry(std::string const& name, int method, bool raw) {
     if (!_zip) {
         auto fileFunc = makeZipFileFunc();
         _zip = zipOpen2_64(_path.u8string().c_str(), false, NULL, &fileFunc);
@@ -83,9 +103,9 @@ void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
                                        nullptr,
                                        0,
                                        nullptr,
-                                       Z_DEFLATED,
-                                       Z_DEFAULT_COMPRESSION,
-                                       0,
+                                       method,
+                                       _level,
+                                       raw,
                                        -MAX_WBITS,
                                        DEF_MEM_LEVEL,
                                        Z_DEFAULT_STRATEGY,
@@ -96,16 +116,285 @@ void ZipWriter::addFile(std::string name, const void* ptr, unsigned size) {
                                        1);
     if (ret)
         throw std::runtime_error("can't add a new file to zip");
-    ret = zipWriteInFileInZip(_zip, ptr, size);
-    if (ret)
-        throw std::runtime_error("can't write to zip");
-    ret = zipCloseFileInZip(_zip);
-    if (ret)
+}
+
+// minizip takes the length of a write as an unsigned int
+void ZipWriter::writeEntry(const void* ptr, size_t size) {
+    auto bytes = static_cast<const char*>(ptr);
+    while (size) {
+        auto chunk = static_cast<unsigned>(std::min<size_t>(size, 1u << 30));
+        if (zipWriteInFileInZip(_zip, bytes, chunk))
+            throw std::runtime_error("can't write to zip");
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+void ZipWriter::addFile(std::string name, const void* ptr, size_t size) {
+    openFile(std::move(name));
+    writeFile(ptr, size);
+    closeFile();
+}
+
+void ZipWriter::addRawFile(std::string name, const void* deflated, size_t size, uint32_t crc, uint64_t inflatedSize) {
+    if (_fileOpen)
+        throw std::runtime_error("a zip entry is still open");
+    openEntry(name, Z_DEFLATED, true);
+    writeEntry(deflated, size);
+    if (zipCloseFileInZipRaw64(_zip, inflatedSize, crc))
         throw std::runtime_error("can't save zip");
 }
 
+void ZipWriter::openFile(std::string name) {
+    if (_fileOpen)
+        throw std::runtime_error("a zip entry is still open");
+    _pendingName = std::move(name);
+    _fileOpen = true;
+}
+
+void ZipWriter::writeFile(const void* ptr, size_t size) {
+    if (!_fileOpen)
+        throw std::runtime_error("no zip entry is open");
+    if (_pendingName) {
+        openEntry(*_pendingName, stores(ptr, size) ? 0 : Z_DEFLATED, false);
+        _pendingName.reset();
+    }
+    writeEntry(ptr, size);
+}
+
+void ZipWriter::closeFile() {
+    if (!_fileOpen)
+        throw std::runtime_error("no zip entry is open");
+    if (_pendingName) {
+        openEntry(*_pendingName, stores(nullptr, 0) ? 0 : Z_DEFLATED, false);
+        _pendingName.reset();
+    }
+    _fileOpen = false;
+    if (zipCloseFileInZip(_zip))
+        throw std::runtime_error("can't save zip");
+}
+
+void ZipWriter::close() {
+    if (!_zip)
+        return;
+    auto ret = zipClose(_zip, nullptr);
+    _zip = nullptr;
+    if (ret)
+        throw std::runtime_error(fmt::format("can't save zip: {}", _path.u8string()));
+}
+
 ZipWriter::~ZipWriter() {
     if (_zip) {
         zipClose(_zip, nullptr);
     }
 }
+
+namespace {
+
+// zlib takes lengths as unsigned ints, larger buffers go in several parts
+const size_t zlibChunk = size_t(1) << 30;
+
+uint32_t crc32Of(std::vector<uint8_t> const& data) {
+    uLong crc = crc32(0, nullptr, 0);
+    for (size_t pos = 0; pos < data.size(); pos += zlibChunk) {
+        crc = crc32(crc, data.data() + pos, static_cast<uInt>(std::min(data.size() - pos, zlibChunk)));
+    }
+    return crc;
+}
+
+// the same stream minizip writes at this level
+std::vector<uint8_t> rawDeflate(std::vector<uint8_t> const& data, int level) {
+    z_stream strm{};
+    if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("zlib init failed");
+    std::vector<uint8_t> res(deflateBound(&strm, std::min(data.size(), zlibChunk)));
+    size_t in = 0;
+    size_t out = 0;
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (strm.avail_in == 0 && in < data.size()) {
+            auto chunk = std::min(data.size() - in, zlibChunk);
+            strm.next_in = (Bytef*)data.data() + in;
+            strm.avail_in = chunk;
+            in += chunk;
+        }
+        if (out == res.size()) {
+            res.resize(res.size() * 2);
+        }
+        auto chunk = std::min(res.size() - out, zlibChunk);
+        strm.next_out = res.data() + out;
+        strm.avail_out = chunk;
+        ret = deflate(&strm, in == data.size() ? Z_FINISH : Z_NO_FLUSH);
+        out += chunk - strm.avail_out;
+    }
+    res.resize(out);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END)
+        throw std::runtime_error("zlib deflate failed");
+    return res;
+}
+
+}
+
+ParallelZipWriter::ParallelZipWriter(std::filesystem::path path, unsigned threads, int level)
+    : _zip(path, level), _level(level), _window(std::max(threads, 1u) * 4)
+{
+    for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+        _workers.emplace_back([this] { deflateEntries(); });
+    }
+    _writer = std::thread([this] { writeEntries(); });
+}
+
+void ParallelZipWriter::push(Entry entry) {
+    {
+        std::unique_lock lock(_mutex);
+        // the archive is written by the calling thread while an entry is
+        // streamed, waiting here would never end
+        if (_streaming)
+            throw std::runtime_error("can't add a zip entry while another one is streamed");
+        _cv.wait(lock, [&] { return _error || _entries.size() < _window; });
+        if (_error)
+            std::rethrow_exception(_error);
+        _entries.push_back(std::move(entry));
+    }
+    _cv.notify_all();
+}
+
+void ParallelZipWriter::addFile(std::string name, const void* ptr, size_t size) {
+    Entry entry;
+    entry.name = std::move(name);
+    entry.data.assign(static_cast<const uint8_t*>(ptr), static_cast<const uint8_t*>(ptr) + size);
+    // stored entries are copied as they are by the writer thread
+    entry.stored = entry.ready = _zip.stores(ptr, size);
+    push(std::move(entry));
+}
+
+void ParallelZipWriter::addRawFile(std::string name, const void* deflated, size_t size, uint32_t crc, uint64_t inflatedSize) {
+    Entry entry;
+    entry.name = std::move(name);
+    entry.data.assign(static_cast<const uint8_t*>(deflated), static_cast<const uint8_t*>(deflated) + size);
+    entry.crc = crc;
+    entry.inflatedSize = inflatedSize;
+    entry.ready = true;
+    push(std::move(entry));
+}
+
+// An entry stays in the deque until it is written, and the deque only grows
+// at the back, so a worker can deflate it in place without the lock.
+void ParallelZipWriter::deflateEntries() {
+    for (;;) {
+        Entry* entry;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [&] {
+                _nextToDeflate = std::max(_nextToDeflate, _written);
+                while (_nextToDeflate < _written + _entries.size() && _entries[_nextToDeflate - _written].ready) {
+                    _nextToDeflate++;
+                }
+                return _stop || _nextToDeflate < _written + _entries.size();
+            });
+            if (_stop)
+                return;
+            entry = &_entries[_nextToDeflate++ - _written];
+        }
+        std::vector<uint8_t> deflated;
+        std::exception_ptr error;
+        try {
+            deflated = rawDeflate(entry->data, _level);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard lock(_mutex);
+            if (error && !_error) {
+                _error = error;
+            }
+            entry->crc = crc32Of(entry->data);
+            entry->inflatedSize = entry->data.size();
+            entry->data = std::move(deflated);
+            entry->ready = true;
+        }
+        _cv.notify_all();
+    }
+}
+
+void ParallelZipWriter::writeEntries() {
+    for (;;) {
+        Entry entry;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [&] { return _stop || _error || (!_entries.empty() && _entries.front().ready); });
+            if (_entries.empty() || !_entries.front().ready || _error)
+                return;
+            entry = std::move(_entries.front());
+            _entries.pop_front();
+            _written++;
+            _writing = true;
+        }
+        _cv.notify_all();
+        std::exception_ptr error;
+        try {
+            if (entry.stored) {
+                _zip.addFile(entry.name, entry.data.data(), entry.data.size());
+            } else {
+                _zip.addRawFile(entry.name, entry.data.data(), entry.data.size(), entry.crc, entry.inflatedSize);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard lock(_mutex);
+            _writing = false;
+            if (error) {
+                _error = error;
+            }
+        }
+        _cv.notify_all();
+        if (error)
+            return;
+    }
+}
+
+void ParallelZipWriter::openFile(std::string name) {
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return _error || (_entries.empty() && !_writing); });
+    if (_error)
+        std::rethrow_exception(_error);
+    _zip.openFile(std::move(name));
+    _streaming = true;
+}
+
+void ParallelZipWriter::writeFile(const void* ptr, size_t size) {
+    _zip.writeFile(ptr, size);
+}
+
+void ParallelZipWriter::closeFile() {
+    _zip.closeFile();
+    std::lock_guard lock(_mutex);
+    _streaming = false;
+}
+
+void ParallelZipWriter::finish() {
+    {
+        std::unique_lock lock(_mutex);
+        _cv.wait(lock, [&] { return _error || _entries.empty(); });
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+    _workers.clear();
+    if (_writer.joinable()) {
+        _writer.join();
+    }
+    if (_error)
+        std::rethrow_exception(_error);
+    _zip.close();
+}
+
+ParallelZipWriter::~ParallelZipWriter() {
+    try {
+        finish();
+    } catch (...) { }
+}
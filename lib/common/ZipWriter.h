@@ -1,15 +1,95 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
 #include <string>
+#include <thread>
 #include <vector>
 
+// whether the bytes start like a format that is compressed already
+// (JPEG, PNG, GIF, WebP, Ogg, MP3 with an ID3 tag, ZIP)
+bool isCompressedMedia(const void* ptr, size_t size);
+
+// The level is a zlib one: -1 is zlib's default and 0 stores every entry.
+// Entries that are compressed media are stored at any level, deflating
+// them again costs time for next to no gain. Entries and the archive
+// itself switch to ZIP64 once they grow past 4 GB.
 class ZipWriter {
     void* _zip = nullptr;
     std::filesystem::path _path;
+    int _level;
+    bool _fileOpen = false;
+    std::optional<std::string> _pendingName; // opened, but nothing written yet
+    void openEntry(std::string const& name, int method, bool raw);
+    void writeEntry(const void* ptr, size_t size);
 
 public:
-    explicit ZipWriter(std::filesystem::path path);
-    void addFile(std::string name, const void* ptr, unsigned size);
+    explicit ZipWriter(std::filesystem::path path, int level = -1);
+    // whether addFile stores these bytes rather than deflates them
+    bool stores(const void* ptr, size_t size) const;
+    void addFile(std::string name, const void* ptr, size_t size);
+    // stores deflate data as is, crc and inflatedSize describe what it inflates to
+    void addRawFile(std::string name, const void* deflated, size_t size, uint32_t crc, uint64_t inflatedSize);
+    // Streams an entry chunk by chunk: openFile, writeFile as many times as
+    // needed, then closeFile. The first chunk decides whether it is stored.
+    void openFile(std::string name);
+    void writeFile(const void* ptr, size_t size);
+    void closeFile();
+    // writes the central directory, as the destructor does, but reports errors
+    void close();
     ~ZipWriter();
 };
+
+// Deflates entries on a pool of threads while a thread of its own appends
+// them to the archive in the order they were added. Up to threads * 4
+// entries are held in memory, adding more blocks until one is written.
+class ParallelZipWriter {
+    struct Entry {
+        std::string name;
+        std::vector<uint8_t> data;
+        uint32_t crc = 0;
+        uint64_t inflatedSize = 0;
+        bool ready = false;
+        bool stored = false;
+    };
+
+    ZipWriter _zip;
+    int _level;
+    std::deque<Entry> _entries;
+    size_t _window;
+    size_t _written = 0; // the number of entries popped from _entries
+    size_t _nextToDeflate = 0;
+    std::exception_ptr _error;
+    bool _stop = false;
+    bool _writing = false; // the writer thread has popped an entry and is writing it
+    bool _streaming = false; // a streamed entry is open on the calling thread
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::thread> _workers;
+    std::thread _writer;
+
+    void push(Entry entry);
+    void deflateEntries();
+    void writeEntries();
+
+public:
+    ParallelZipWriter(std::filesystem::path path, unsigned threads, int level = -1);
+    ParallelZipWriter(ParallelZipWriter const&) = delete;
+    ParallelZipWriter& operator=(ParallelZipWriter const&) = delete;
+    void addFile(std::string name, const void* ptr, size_t size);
+    void addRawFile(std::string name, const void* deflated, size_t size, uint32_t crc, uint64_t inflatedSize);
+    // A streamed entry goes straight to the archive on the calling thread,
+    // after the entries added before it are written. Adding an entry before
+    // it is closed throws.
+    void openFile(std::string name);
+    void writeFile(const void* ptr, size_t size);
+    void closeFile();
+    // waits until every entry is written, rethrows the first error
+    void finish();
+    ~ParallelZipWriter();
+};
@@ -13,10 +13,17 @@ bool Archive::readBlock(uint32_t index) {
     auto size = _index.at(index + 1) - offset;
     if (!size)
         return false;
-    _bofBuf.resize(size);
-    _bof->seek(offset);
-    _bof->readSome(_bofBuf.data(), _bofBuf.size());
-    decodeBofBlock(_bofBuf.data(), _bofBuf.size(), _decodedBofBlock);
+    auto mapped = _bof->span();
+    if (!mapped.empty()) {
+        if (offset > mapped.size() || size > mapped.size() - offset)
+            throw std::runtime_error("bof block is out of bounds");
+        decodeBofBlock(mapped.data() + offset, size, _decodedBofBlock);
+    } else {
+        _bofBuf.resize(size);
+        _bof->seek(offset);
+        _bof->readSome(_bofBuf.data(), _bofBuf.size());
+        decodeBofBlock(_bofBuf.data(), _bofBuf.size(), _decodedBofBlock);
+    }
     if (_decodedBofBlock.size() > g_DecodedBofBlockSize)
         throw std::runtime_error("bof block is too large");
     _lastBlock = index;
@@ -91,7 +91,7 @@ FileSystem::FileSystem(std::filesystem::path root) : _root(root) {}
 
 std::unique_ptr<common::IRandomAccessStream> FileSystem::open(std::filesystem::path path) {
     auto absolute = _root / path;
-    return std::make_unique<common::FileStream>(absolute);
+    return std::make_unique<common::MappedFileStream>(absolute);
 }
 
 const CaseInsensitiveSet& FileSystem::files() {
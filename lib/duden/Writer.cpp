@@ -14,10 +14,16 @@
 #include "lingvo/tools.h"
 #include "common/WavWriter.h"
 
+#include <algorithm>
+#include <thread>
+
 namespace duden {
 
 using namespace std::literals;
 
+inline constexpr uint32_t streamedResourceSize = 16 << 20;
+inline constexpr uint32_t streamedChunkSize = 1 << 20;
+
 namespace {
 
 class ResourceFileSystem : public IFileSystem {
@@ -51,7 +57,7 @@ std::unique_ptr<IResourceArchiveReader> makeArchiveReader(std::filesystem::path
                                                           const duden::ResourceArchive& archive) {
     if (archive.fsd.empty()) {
         common::FileStream fIdx(inputPath / archive.idx);
-        auto fBof = std::make_shared<common::FileStream>(inputPath / archive.bof);
+        auto fBof = std::make_shared<common::MappedFileStream>(inputPath / archive.bof);
         return std::make_unique<Archive>(&fIdx, fBof);
     } else {
         auto fFsd = std::make_shared<common::FileStream>(inputPath / archive.fsd);
@@ -79,7 +85,8 @@ std::string defaultArticleResolve(const std::map<int32_t, HeadingGroup>& groups,
 void writeDSL(std::filesystem::path infPath,
               std::filesystem::path outputPath,
               int index,
-              Log& log) {
+              Log& log,
+              int zipLevel) {
     auto inputPath = infPath.parent_path();
     duden::FileSystem fs(infPath.parent_path());
     duden::Dictionary dict(&fs, infPath, index);
@@ -95,7 +102,7 @@ void writeDSL(std::filesystem::path infPath,
 
     dsl::Writer writer(outputPath, dslFileName);
     auto overlayPath = std::filesystem::u8path(writer.dslFilePath().u8string() + ".files.zip");
-    ZipWriter zip(overlayPath);
+    ParallelZipWriter zip(overlayPath, std::max(std::thread::hardware_concurrency(), 1u), zipLevel);
 
     ResourceFiles resources;
     for (auto& pack : dict.inf().resources) {
@@ -105,7 +112,7 @@ void writeDSL(std::filesystem::path infPath,
         log.regular("unpacking {}", pack.bof);
 
         common::FileStream fIndex(inputPath / pack.idx);
-        auto fBof = std::make_shared<common::FileStream>(inputPath / pack.bof);
+        auto fBof = std::make_shared<common::MappedFileStream>(inputPath / pack.bof);
         Archive archive(&fIndex, fBof);
         std::vector<char> vec;
         archive.read(0, -1, vec);
@@ -147,16 +154,28 @@ void writeDSL(std::filesystem::path infPath,
                 log.regular("resource {} has invalid offset {:x}", entry.name, entry.offset);
                 continue;
             }
-            reader->read(entry.offset, entry.size, vec);
-
             auto name = entry.name;
             if (replaceAdpExtWithWav(name)) {
+                reader->read(entry.offset, entry.size, vec);
                 decodeAdp(vec, samples);
                 common::createWav(samples, vec, ADP_SAMPLE_RATE, ADP_CHANNELS);
+                zip.addFile(name, vec.data(), vec.size());
                 adpCount++;
+            } else if (entry.size > streamedResourceSize) {
+                // large pictures go into the archive a chunk at a time
+                zip.openFile(name);
+                for (uint32_t pos = 0; pos < entry.size && entry.offset + pos < reader->decodedSize();) {
+                    reader->read(entry.offset + pos, std::min(entry.size - pos, streamedChunkSize), vec);
+                    if (vec.empty())
+                        break;
+                    zip.writeFile(vec.data(), vec.size());
+                    pos += vec.size();
+                }
+                zip.closeFile();
+            } else {
+                reader->read(entry.offset, entry.size, vec);
+                zip.addFile(name, vec.data(), vec.size());
             }
-
-            zip.addFile(name, vec.data(), vec.size());
             resourceFileNames.push_back(name);
             ++i;
             ++resourceCount;
@@ -176,7 +195,7 @@ void writeDSL(std::filesystem::path infPath,
             }
             auto [pack, offset, size] = it->second;
             common::FileStream fIndex(inputPath / pack->idx);
-            auto fBof = std::make_shared<common::FileStream>(inputPath / pack->bof);
+            auto fBof = std::make_shared<common::MappedFileStream>(inputPath / pack->bof);
             Archive archive(&fIndex, fBof);
             archive.read(offset, size, vec);
             return vec;
@@ -251,6 +270,9 @@ void writeDSL(std::filesystem::path infPath,
         }, htmlTablePtrs, log);
     }
 
+    zip.finish();
+    writer.flush();
+
     log.regular("done converting: {} articles ({} errors), {} tables, {} resources, {} audio files",
                 articleCount,
                 failedArticleCount,
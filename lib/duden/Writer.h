@@ -16,7 +16,8 @@ enum class LogLevel {
 void writeDSL(std::filesystem::path infPath,
               std::filesystem::path outputPath,
               int index,
-              Log& progress);
+              Log& progress,
+              int zipLevel = -1);
 
 std::string defaultArticleResolve(const std::map<int32_t, HeadingGroup>& groups,
                                   int64_t offset,
@@ -35,6 +35,7 @@ void AbbreviationDictionaryDecoder::Read(common::IBitStream *bstr){
     _headingSymbols = readXoredSymbols(bstr);
     _ltArticles.Read(*bstr);
     _ltHeadings.Read(*bstr);
+    _headingRuns.Build(_ltHeadings, _headingSymbols);
 
     _ltPrefixLengths.Read(*bstr);
     _ltPostfixLengths.Read(*bstr);
@@ -43,38 +44,55 @@ void AbbreviationDictionaryDecoder::Read(common::IBitStream *bstr){
     _huffman2Number = bstr->read(32);
 }
 
-void AbbreviationDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) {
-    res.clear();
-    unsigned symIdx;
-    for (size_t i = 0; i < len; i++) {
-        _ltHeadings.Decode(*bstr, symIdx);
-        unsigned sym = _headingSymbols.at(symIdx);
-        assert(sym <= 0xffff);
-        res += (char16_t)sym;
-    }
+void AbbreviationDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
+}
+
+bool AbbreviationDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) const {
+    return UserDictionaryDecoder::DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
+}
+
+bool AbbreviationDictionaryDecoder::DecodePrefixLen(common::IBitStream &bstr, unsigned &len) const {
+    return _ltPrefixLengths.Decode(bstr, len);
+}
+
+bool AbbreviationDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) const {
+    return _ltPostfixLengths.Decode(bstr, len);
+}
+
+bool AbbreviationDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman1Number);
+}
+
+bool AbbreviationDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman2Number);
+}
+
+void AbbreviationDictionaryDecoder::DecodeHeading(common::MemoryBitReader *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
 }
 
-bool AbbreviationDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) {
+bool AbbreviationDictionaryDecoder::DecodeArticle(common::MemoryBitReader *bstr, std::u16string &res) const {
     return UserDictionaryDecoder::DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
 }
 
-bool AbbreviationDictionaryDecoder::DecodePrefixLen(common::IBitStream &bstr, unsigned &len) {
+bool AbbreviationDictionaryDecoder::DecodePrefixLen(common::MemoryBitReader &bstr, unsigned &len) const {
     return _ltPrefixLengths.Decode(bstr, len);
 }
 
-bool AbbreviationDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) {
+bool AbbreviationDictionaryDecoder::DecodePostfixLen(common::MemoryBitReader &bstr, unsigned &len) const {
     return _ltPostfixLengths.Decode(bstr, len);
 }
 
-bool AbbreviationDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) {
+bool AbbreviationDictionaryDecoder::ReadReference1(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman1Number);
 }
 
-bool AbbreviationDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) {
+bool AbbreviationDictionaryDecoder::ReadReference2(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman2Number);
 }
 
-std::u16string AbbreviationDictionaryDecoder::Prefix() {
+std::u16string AbbreviationDictionaryDecoder::Prefix() const {
     return _prefix;
 }
 
@@ -0,0 +1,46 @@
+#include "ArticleCache.h"
+
+namespace lingvo {
+
+ArticleCache::ArticleCache(size_t budget) : _budget(budget) { }
+
+size_t ArticleCache::cost(Entry const& entry) {
+    return sizeof(Entry) + entry.article.size() * sizeof(char16_t);
+}
+
+bool ArticleCache::get(unsigned reference, std::u16string& article) {
+    std::lock_guard lock(_mutex);
+    auto it = _index.find(reference);
+    if (it == end(_index)) {
+        _misses++;
+        return false;
+    }
+    _hits++;
+    _entries.splice(begin(_entries), _entries, it->second);
+    article = it->second->article;
+    return true;
+}
+
+void ArticleCache::put(unsigned reference, std::u16string const& article) {
+    Entry entry{reference, article};
+    if (cost(entry) > _budget)
+        return;
+    std::lock_guard lock(_mutex);
+    if (_index.count(reference))
+        return;
+    _bytes += cost(entry);
+    _entries.push_front(std::move(entry));
+    _index[reference] = begin(_entries);
+    while (_bytes > _budget) {
+        _bytes -= cost(_entries.back());
+        _index.erase(_entries.back().reference);
+        _entries.pop_back();
+    }
+}
+
+ArticleCacheStats ArticleCache::stats() const {
+    std::lock_guard lock(_mutex);
+    return {_hits, _misses, _entries.size(), _bytes};
+}
+
+}
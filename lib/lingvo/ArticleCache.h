@@ -0,0 +1,41 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+namespace lingvo {
+
+struct ArticleCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t articles = 0;
+    size_t bytes = 0;
+};
+
+// Decoded articles by reference. Once they take more than the byte budget
+// the least recently used ones are dropped. Safe to use from several threads.
+class ArticleCache {
+    struct Entry {
+        unsigned reference;
+        std::u16string article;
+    };
+    size_t _budget;
+    size_t _bytes = 0;
+    std::list<Entry> _entries; // the most recently used first
+    std::unordered_map<unsigned, std::list<Entry>::iterator> _index;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    mutable std::mutex _mutex;
+    static size_t cost(Entry const& entry);
+public:
+    explicit ArticleCache(size_t budget);
+    // copies the article into article and returns true if it is cached
+    bool get(unsigned reference, std::u16string& article);
+    void put(unsigned reference, std::u16string const& article);
+    ArticleCacheStats stats() const;
+};
+
+}
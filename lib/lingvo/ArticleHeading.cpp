@@ -3,69 +3,196 @@
 #include "IDictionaryDecoder.h"
 #include "common/BitStream.h"
 #include <assert.h>
-#include <map>
+#include <array>
 #include <algorithm>
-#include <list>
 #include <memory>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
 
 namespace lingvo {
 
-void ArticleHeading::makeCharsFromPairs(std::deque<ExtPair>& pairs, std::u16string const& text) {
-    std::deque<char16_t> textDeque(begin(text), end(text));
+template <class CharAt>
+std::u16string makeDslText(size_t count, CharAt charAt) {
+    std::u16string extText;
+    bool group = false;
+    for (size_t i = 0; i < count; ++i) {
+        CharInfo info = charAt(i);
+        if (group && info.sorted) {
+            extText += u"}";
+            group = false;
+        } else if (!group && !info.sorted) {
+            extText += u"{";
+            group = true;
+        }
+        if (info.escaped)
+            extText += '\\';
+        extText += info.chr;
+    }
+    if (group) {
+        extText += u"}";
+    }
+    return extText;
+}
+
+// Decodes the next heading of a leaf page and passes its characters to
+// emit(chr, sorted, escaped). The sorted text is the known prefix of the page
+// followed by the decoded postfix, the unsorted characters come as
+// (index, char) pairs to be merged into it.
+template <common::BitReader Reader, class Emit>
+void decodeHeadingChars(IDictionaryDecoder const& decoder,
+                        Reader &bstr,
+                        std::u16string &knownPrefix,
+                        std::u16string &postfix,
+                        unsigned &reference,
+                        Emit emit)
+{
+    unsigned prefixLen;
+    decoder.DecodePrefixLen(bstr, prefixLen);
+    unsigned postfixLen;
+    decoder.DecodePostfixLen(bstr, postfixLen);
+    decoder.DecodeHeading(&bstr, postfixLen, postfix);
+    decoder.ReadReference2(bstr, reference);
+    knownPrefix.resize(std::min<size_t>(prefixLen, knownPrefix.size()));
+    knownPrefix += postfix;
+
+    ExtPair pairs[255];
+    unsigned pairCount = 0;
+    if (bstr.read(1)) {
+        pairCount = bstr.read(8);
+        for (unsigned i = 0; i < pairCount; ++i) {
+            pairs[i].idx = bstr.read(8);
+            pairs[i].chr = bstr.read(16);
+        }
+    }
+
     size_t idx = 0;
-    _chars.reserve(pairs.size());
+    unsigned pairPos = 0;
+    size_t textPos = 0;
     auto nextChar = [&](char16_t& chr) {
-        if (!pairs.empty() && pairs.front().idx == idx) {
-            chr = pairs.front().chr;
-            pairs.pop_front();
+        if (pairPos < pairCount && pairs[pairPos].idx == idx) {
+            chr = pairs[pairPos++].chr;
             return false;
         }
-        chr = textDeque.front();
-        textDeque.pop_front();
+        if (textPos == knownPrefix.size())
+            throw std::runtime_error("invalid heading");
+        chr = knownPrefix[textPos++];
         return true;
     };
 
-    while (!textDeque.empty() || !pairs.empty()) {
-        CharInfo info;
-        info.escaped = false;
-        info.sorted = nextChar(info.chr);
-        if (info.chr == '\\') {
+    while (textPos < knownPrefix.size() || pairPos < pairCount) {
+        char16_t chr;
+        bool escaped = false;
+        bool sorted = nextChar(chr);
+        if (chr == '\\') {
             idx++;
-            info.sorted = nextChar(info.chr);
-            info.escaped = true;
+            sorted = nextChar(chr);
+            escaped = true;
         }
-        _chars.push_back(info);
+        emit(chr, sorted, escaped);
         idx++;
     }
 }
 
+template <common::BitReader Reader>
+bool ArticleHeading::load(
+        IDictionaryDecoder const& decoder,
+        Reader &bstr,
+        std::u16string &knownPrefix)
+{
+    std::u16string postfix;
+    _chars.clear();
+    decodeHeadingChars(decoder, bstr, knownPrefix, postfix, _reference, [&](char16_t chr, bool sorted, bool escaped) {
+        _chars.push_back({sorted, escaped, chr});
+    });
+    return true;
+}
+
 bool ArticleHeading::Load(
-        IDictionaryDecoder &decoder,
+        IDictionaryDecoder const& decoder,
         common::IBitStream &bstr,
         std::u16string &knownPrefix)
 {
-    std::u16string text;
-    std::deque<ExtPair> pairs;
+    return load(decoder, bstr, knownPrefix);
+}
 
-    unsigned prefixLen;
-    decoder.DecodePrefixLen(bstr, prefixLen);
-    unsigned postfixLen;
-    decoder.DecodePostfixLen(bstr, postfixLen);
-    decoder.DecodeHeading(&bstr, postfixLen, text);
-    decoder.ReadReference2(bstr, _reference);
-    knownPrefix = knownPrefix.substr(0, prefixLen) + text;
-    if (bstr.read(1)) {
-        unsigned len = bstr.read(8);
-        for (unsigned i = 0; i < len; ++i) {
-            unsigned char idx = bstr.read(8);
-            char16_t chr = bstr.read(16);
-            pairs.push_back({idx, chr});
-        }
-    }
-    makeCharsFromPairs(pairs, knownPrefix);
+bool ArticleHeading::Load(
+        IDictionaryDecoder const& decoder,
+        common::MemoryBitReader &bstr,
+        std::u16string &knownPrefix)
+{
+    return load(decoder, bstr, knownPrefix);
+}
+
+template <common::BitReader Reader>
+bool HeadingStore::load(
+        IDictionaryDecoder const& decoder,
+        Reader &bstr,
+        std::u16string &knownPrefix)
+{
+    unsigned reference;
+    decodeHeadingChars(decoder, bstr, knownPrefix, _postfix, reference, [&](char16_t chr, bool sorted, bool escaped) {
+        _chars.push_back(chr);
+        _sorted.push_back(sorted);
+        _escaped.push_back(escaped);
+    });
+    _offsets.push_back(_chars.size());
+    _references.push_back(reference);
     return true;
 }
 
+bool HeadingStore::Load(
+        IDictionaryDecoder const& decoder,
+        common::IBitStream &bstr,
+        std::u16string &knownPrefix)
+{
+    return load(decoder, bstr, knownPrefix);
+}
+
+bool HeadingStore::Load(
+        IDictionaryDecoder const& decoder,
+        common::MemoryBitReader &bstr,
+        std::u16string &knownPrefix)
+{
+    return load(decoder, bstr, knownPrefix);
+}
+
+void HeadingStore::append(HeadingStore const& other) {
+    auto base = _chars.size();
+    _chars.insert(end(_chars), begin(other._chars), end(other._chars));
+    _sorted.insert(end(_sorted), begin(other._sorted), end(other._sorted));
+    _escaped.insert(end(_escaped), begin(other._escaped), end(other._escaped));
+    for (auto it = std::next(begin(other._offsets)); it != end(other._offsets); ++it) {
+        _offsets.push_back(base + *it);
+    }
+    _references.insert(end(_references), begin(other._references), end(other._references));
+}
+
+size_t HeadingStore::size() const {
+    return _references.size();
+}
+
+ArticleHeading HeadingStore::heading(size_t index) const {
+    ArticleHeading heading;
+    heading._reference = _references[index];
+    for (auto i = _offsets[index]; i < _offsets[index + 1]; ++i) {
+        heading._chars.push_back({_sorted[i], _escaped[i], _chars[i]});
+    }
+    return heading;
+}
+
+std::u16string HeadingStore::dslText(size_t index) const {
+    auto first = _offsets[index];
+    return makeDslText(_offsets[index + 1] - first, [&](size_t i) {
+        return CharInfo{_sorted[first + i], _escaped[first + i], _chars[first + i]};
+    });
+}
+
+unsigned HeadingStore::articleReference(size_t index) const {
+    return _references[index];
+}
+
 std::u16string ArticleHeading::text() const {
     std::u16string text;
     for (auto& info : _chars) {
@@ -77,25 +204,7 @@ std::u16string ArticleHeading::text() const {
 }
 
 std::u16string ArticleHeading::dslText() {
-    std::u16string extText;
-    extText.clear();
-    bool group = false;
-    for (CharInfo& info : _chars) {
-        if (group && info.sorted) {
-            extText += u"}";
-            group = false;
-        } else if (!group && !info.sorted) {
-            extText += u"{";
-            group = true;
-        }
-        if (info.escaped)
-            extText += '\\';
-        extText += info.chr;
-    }
-    if (group) {
-        extText += u"}";
-    }
-    return extText;
+    return makeDslText(_chars.size(), [&](size_t i) { return _chars[i]; });
 }
 
 unsigned ArticleHeading::articleReference() const {
@@ -207,8 +316,6 @@ bool tryCollapse(ArticleHeading& variant1,
                  Matcher matcherA,
                  Matcher matcherB)
 {
-    variant1.dslText();
-    variant2.dslText();
     CharVec const& chars1 = variant1._chars;
     CharVec const& chars2 = variant2._chars;
     CharVec aleft, amiddle, aright;
@@ -263,21 +370,213 @@ bool tryCollapseEF(ArticleHeading& variant1, ArticleHeading& variant2, ArticleHe
     return tryCollapse(variant1, variant2, collapsed, beforeMiddle, afterMiddle, matchE, matchF);
 }
 
-std::vector<ArticleHeading>::iterator tryCollapsePair(
-        std::vector<ArticleHeading>::iterator first,
-        std::vector<ArticleHeading>::iterator last)
-{
-    for (auto i = first; i != last; ++i) {
-        for (auto j = std::next(i); j != last; ++j) {
-            if (tryCollapseAB(*i, *j, *i) ||
-                tryCollapseCD(*i, *j, *i) ||
-                tryCollapseEF(*i, *j, *i)) {
-                return j;
+// Collapses the variants of one reference set in the order of a pairwise
+// scan: the first heading i that collapses with a later heading j, with the
+// first such j, trying AB, CD and EF in turn, then the scan starts over.
+// Collapsed headings stay in the set and can still pair with others.
+//
+// Instead of trying every pair, each heading is split once per pattern by
+// both matchers, and the splits are indexed by a key that holds exactly what
+// tryCollapse compares. A pair collapses when the A split of one heading and
+// the B split of the other have the same key, so partners are hash lookups.
+// Only the heading that changed needs to be looked at after a collapse: it
+// is the only one that can pair with an earlier heading, and every earlier
+// heading is known not to pair with anything else.
+class VariantSetCollapser {
+    struct Pattern {
+        Matcher matcherA;
+        Matcher matcherB;
+        bool (*collapse)(ArticleHeading&, ArticleHeading&, ArticleHeading&);
+    };
+
+    struct Split {
+        bool a = false;
+        bool b = false;
+        std::u16string keyA;
+        std::u16string keyB;
+    };
+
+    typedef std::unordered_map<std::u16string, std::set<size_t>> Index;
+
+    struct PatternIndex {
+        Index byA; // headings matched by matcherA, by their A key
+        Index byB; // headings matched by matcherB, by their B key
+        Index byOnlyB; // the same, without the ones matched by matcherA
+    };
+
+    static constexpr size_t patternsCount = 3;
+    std::array<Pattern, patternsCount> _patterns;
+    ArticleHeadingIter _first;
+    size_t _count;
+    std::vector<std::array<Split, patternsCount>> _splits;
+    std::array<PatternIndex, patternsCount> _indices;
+
+    static std::u16string makeKey(CharVec const& left, CharVec const& middle, CharVec const& right) {
+        std::u16string key;
+        auto add = [&](CharVec const& part, bool withSorted) {
+            for (auto& info : part) {
+                key += char16_t((withSorted && info.sorted) | (info.escaped << 1));
+                key += info.chr;
             }
+            key += char16_t(4);
+        };
+        add(left, true);
+        add(middle, false);
+        add(right, true);
+        return key;
+    }
+
+    static void add(Index& index, std::u16string const& key, size_t pos) {
+        index[key].insert(pos);
+    }
+
+    static void remove(Index& index, std::u16string const& key, size_t pos) {
+        auto it = index.find(key);
+        it->second.erase(pos);
+        if (it->second.empty()) {
+            index.erase(it);
         }
     }
-    return last;
-}
+
+    static std::set<size_t> const* find(Index const& index, std::u16string const& key) {
+        auto it = index.find(key);
+        return it == end(index) ? nullptr : &it->second;
+    }
+
+    void index(size_t pos) {
+        CharVec const& chars = _first[pos]._chars;
+        CharVec left, middle, right;
+        for (size_t p = 0; p < patternsCount; ++p) {
+            auto& split = _splits[pos][p];
+            auto& indices = _indices[p];
+            split = {};
+            if (_patterns[p].matcherA(chars, left, middle, right)) {
+                split.a = true;
+                split.keyA = makeKey(left, middle, right);
+                add(indices.byA, split.keyA, pos);
+            }
+            if (_patterns[p].matcherB(chars, left, middle, right)) {
+                split.b = true;
+                split.keyB = makeKey(left, middle, right);
+                add(indices.byB, split.keyB, pos);
+                if (!split.a) {
+                    add(indices.byOnlyB, split.keyB, pos);
+                }
+            }
+        }
+    }
+
+    void unindex(size_t pos) {
+        for (size_t p = 0; p < patternsCount; ++p) {
+            auto& split = _splits[pos][p];
+            auto& indices = _indices[p];
+            if (split.a) {
+                remove(indices.byA, split.keyA, pos);
+            }
+            if (split.b) {
+                remove(indices.byB, split.keyB, pos);
+                if (!split.a) {
+                    remove(indices.byOnlyB, split.keyB, pos);
+                }
+            }
+        }
+    }
+
+    // the first j > i that collapses with i, or _count
+    size_t laterPartner(size_t i) const {
+        size_t res = _count;
+        for (size_t p = 0; p < patternsCount; ++p) {
+            auto& split = _splits[i][p];
+            auto& indices = _indices[p];
+            // tryCollapse tries matcherA on the first heading and only
+            // falls back to matcherB if that fails
+            auto partners = split.a ? find(indices.byB, split.keyA)
+                          : split.b ? find(indices.byA, split.keyB)
+                          : nullptr;
+            if (partners) {
+                auto it = partners->upper_bound(i);
+                if (it != partners->end()) {
+                    res = std::min(res, *it);
+                }
+            }
+        }
+        return res;
+    }
+
+    // the first i' < i that collapses with i, or _count
+    size_t earlierPartner(size_t i) const {
+        size_t res = _count;
+        auto consider = [&](std::set<size_t> const* partners) {
+            if (partners && *partners->begin() < i) {
+                res = std::min(res, *partners->begin());
+            }
+        };
+        for (size_t p = 0; p < patternsCount; ++p) {
+            auto& split = _splits[i][p];
+            auto& indices = _indices[p];
+            if (split.b) {
+                consider(find(indices.byA, split.keyB));
+            }
+            if (split.a) {
+                consider(find(indices.byOnlyB, split.keyA));
+            }
+        }
+        return res;
+    }
+
+    void collapse(size_t i, size_t j) {
+        unindex(i);
+        auto& variant1 = _first[i];
+        auto& variant2 = _first[j];
+        bool collapsed = false;
+        for (auto& pattern : _patterns) {
+            if (pattern.collapse(variant1, variant2, variant1)) {
+                collapsed = true;
+                break;
+            }
+        }
+        assert(collapsed);
+        (void)collapsed;
+        index(i);
+    }
+
+public:
+    VariantSetCollapser(ArticleHeadingIter first, ArticleHeadingIter last)
+        : _patterns{{{matchA, matchB, tryCollapseAB},
+                     {matchC, matchD, tryCollapseCD},
+                     {matchE, matchF, tryCollapseEF}}},
+          _first(first),
+          _count(std::distance(first, last)),
+          _splits(_count)
+    {
+        for (size_t pos = 0; pos < _count; ++pos) {
+            index(pos);
+        }
+    }
+
+    // calls onRemove with the position of every heading collapsed into another
+    template <class OnRemove>
+    void run(OnRemove onRemove) {
+        size_t i = 0;
+        while (i < _count) {
+            auto j = laterPartner(i);
+            if (j == _count) {
+                ++i;
+                continue;
+            }
+            collapse(i, j);
+            onRemove(j);
+            for (;;) {
+                auto earlier = earlierPartner(i);
+                if (earlier == _count)
+                    break;
+                collapse(earlier, i);
+                onRemove(i);
+                i = earlier;
+            }
+        }
+    }
+};
 
 void foreachReferenceSet(std::vector<ArticleHeading>& groupedHeadings,
                          std::function<void(ArticleHeadingIter, ArticleHeadingIter)> func,
@@ -297,27 +596,78 @@ void foreachReferenceSet(std::vector<ArticleHeading>& groupedHeadings,
     }
 }
 
+// compress the vector of headings and remove the collapsed tail
+static void removeCollapsed(std::vector<ArticleHeading>& headings, std::vector<bool> const& toRemove) {
+    size_t kept = 0;
+    for (size_t i = 0; i < headings.size(); ++i) {
+        if (!toRemove[i]) {
+            if (kept != i) {
+                headings[kept] = std::move(headings[i]);
+            }
+            kept++;
+        }
+    }
+    headings.erase(begin(headings) + kept, end(headings));
+}
+
 void collapseVariants(std::vector<ArticleHeading>& headings) {
     groupHeadingsByReference(headings);
     // collapse adjacent variant headings if possible
     std::vector<bool> toRemove(headings.size(), false);
     foreachReferenceSet(headings, [&](auto first, auto last) {
         if (std::distance(first, last) > 1) {
-            for (;;) {
-                auto j = tryCollapsePair(first, last);
-                if (j == last)
-                    break;
-                toRemove[std::distance(begin(headings), j)] = true;
-            }
+            auto offset = std::distance(begin(headings), first);
+            VariantSetCollapser(first, last).run([&](size_t pos) {
+                toRemove[offset + pos] = true;
+            });
         }
     });
-    // compress the vector of headings and remove the collapsed tail
-    std::vector<ArticleHeading> compressed;
-    std::copy_if(begin(headings), end(headings), std::back_inserter(compressed), [&](auto& h) {
-        auto idx = &h - &headings[0];
-        return !toRemove[idx];
+    removeCollapsed(headings, toRemove);
+}
+
+void collapseVariantSet(std::vector<ArticleHeading>& headings) {
+    if (headings.size() < 2)
+        return;
+    std::vector<bool> toRemove(headings.size(), false);
+    VariantSetCollapser(begin(headings), end(headings)).run([&](size_t pos) {
+        toRemove[pos] = true;
     });
-    std::swap(headings, compressed);
+    removeCollapsed(headings, toRemove);
+}
+
+// Lingvo sorts the headings without regard to case, and letters with
+// diacritics go with their base letters, as in printed dictionaries. Only the
+// scripts dictionaries are commonly written in are folded: Latin-1, Greek and
+// Cyrillic.
+static char16_t foldCase(char16_t chr) {
+    if ((chr >= u'A' && chr <= u'Z') || (chr >= 0xc0 && chr <= 0xde && chr != 0xd7))
+        return chr + 0x20;
+    if ((chr >= 0x391 && chr <= 0x3ab && chr != 0x3a2) || (chr >= 0x410 && chr <= 0x42f))
+        return chr + 0x20;
+    if (chr >= 0x400 && chr <= 0x40f)
+        return chr + 0x50;
+    return chr;
+}
+
+// æ, ð, ø and þ are letters of their own
+static char16_t foldHeadingChar(char16_t chr) {
+    static const char16_t latin1[] = u"aaaaaa\u00e6ceeeeiiii\u00f0nooooo\u00f7\u00f8uuuuy\u00fey";
+    chr = foldCase(chr);
+    if (chr >= 0xe0 && chr <= 0xff)
+        return latin1[chr - 0xe0];
+    if (chr == 0x451) // ё
+        return 0x435;
+    return chr;
+}
+
+int compareHeadings(std::u16string_view left, std::u16string_view right) {
+    for (size_t i = 0; i < left.size() && i < right.size(); ++i) {
+        auto l = foldHeadingChar(left[i]);
+        auto r = foldHeadingChar(right[i]);
+        if (l != r)
+            return l < r ? -1 : 1;
+    }
+    return left.size() == right.size() ? 0 : left.size() < right.size() ? -1 : 1;
 }
 
 bool CharInfo::operator==(CharInfo const& other) const {
@@ -326,19 +676,26 @@ bool CharInfo::operator==(CharInfo const& other) const {
         && chr == other.chr;
 }
 
-void groupHeadingsByReference(std::vector<ArticleHeading>& vec) {
-    std::map<unsigned, std::vector<size_t>> map;
-    for (auto it = begin(vec); it != end(vec); ++it) {
-        map[it->articleReference()].push_back(std::distance(begin(vec), it));
+std::vector<uint32_t> referenceSetOrder(size_t count, std::function<unsigned(size_t)> reference) {
+    std::unordered_map<unsigned, uint32_t> firstMention;
+    std::vector<uint32_t> setIndex(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        setIndex[i] = firstMention.try_emplace(reference(i), i).first->second;
     }
+    std::vector<uint32_t> order(count);
+    std::iota(begin(order), end(order), 0);
+    std::stable_sort(begin(order), end(order), [&](auto a, auto b) {
+        return setIndex[a] < setIndex[b];
+    });
+    return order;
+}
+
+void groupHeadingsByReference(std::vector<ArticleHeading>& vec) {
+    auto order = referenceSetOrder(vec.size(), [&](size_t i) { return vec[i].articleReference(); });
     std::vector<ArticleHeading> res;
-    for (auto it = begin(vec); it != end(vec); ++it) {
-        auto ref = it->articleReference();
-        auto pair = map.find(ref);
-        for (auto j = begin(pair->second); j != end(pair->second); ++j) {
-            res.push_back(vec[*j]);
-        }
-        pair->second.clear();
+    res.reserve(vec.size());
+    for (auto i : order) {
+        res.push_back(std::move(vec[i]));
     }
     std::swap(vec, res);
 }
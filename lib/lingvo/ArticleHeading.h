@@ -1,9 +1,11 @@
 #pragma once
 
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include <string>
-#include <deque>
+#include <string_view>
 #include <functional>
+#include <vector>
 
 namespace lingvo {
 
@@ -26,8 +28,11 @@ class IDictionaryDecoder;
 class ArticleHeading {
     std::vector<CharInfo> _chars;
     unsigned _reference;
-    void makeExtTextFromChars();
-    void makeCharsFromPairs(std::deque<ExtPair>& pairs, std::u16string const& text);
+    template <common::BitReader Reader>
+    bool load(IDictionaryDecoder const& decoder, Reader& bstr, std::u16string& knownPrefix);
+    friend class HeadingStore;
+    friend class HeadingIndex;
+    friend class VariantSetCollapser;
     friend void collapseVariants(std::vector<ArticleHeading> &);
     friend bool tryCollapse(ArticleHeading& variant1,
                             ArticleHeading& variant2,
@@ -37,16 +42,54 @@ class ArticleHeading {
                             Matcher matcherA,
                             Matcher matcherB);
 public:
-    bool Load(IDictionaryDecoder& decoder,
+    bool Load(IDictionaryDecoder const& decoder,
               common::IBitStream& bstr,
               std::u16string& knownPrefix);
+    bool Load(IDictionaryDecoder const& decoder,
+              common::MemoryBitReader& bstr,
+              std::u16string& knownPrefix);
     std::u16string text() const;
     std::u16string dslText();
     unsigned articleReference() const;
 };
 
+// The headings of a dictionary in a few flat arrays instead of an
+// ArticleHeading with its own vector of CharInfo per heading: the characters
+// of all headings back to back, their sorted and escaped flags as packed
+// bits and, per heading, the offset of its first character and its article
+// reference.
+class HeadingStore {
+    std::vector<char16_t> _chars;
+    std::vector<bool> _sorted;
+    std::vector<bool> _escaped;
+    std::vector<uint32_t> _offsets{0};
+    std::vector<uint32_t> _references;
+    std::u16string _postfix;
+    template <common::BitReader Reader>
+    bool load(IDictionaryDecoder const& decoder, Reader& bstr, std::u16string& knownPrefix);
+public:
+    bool Load(IDictionaryDecoder const& decoder,
+              common::IBitStream& bstr,
+              std::u16string& knownPrefix);
+    bool Load(IDictionaryDecoder const& decoder,
+              common::MemoryBitReader& bstr,
+              std::u16string& knownPrefix);
+    void append(HeadingStore const& other);
+    size_t size() const;
+    ArticleHeading heading(size_t index) const;
+    std::u16string dslText(size_t index) const;
+    unsigned articleReference(size_t index) const;
+};
+
 void collapseVariants(std::vector<ArticleHeading> &headings);
+// the same for headings that all reference the same article
+void collapseVariantSet(std::vector<ArticleHeading> &headings);
 void groupHeadingsByReference(std::vector<ArticleHeading>& headings);
+// the positions of count headings in the order groupHeadingsByReference puts
+// them: reference sets by their first heading, each in the original order
+std::vector<uint32_t> referenceSetOrder(size_t count, std::function<unsigned(size_t)> reference);
+// orders heading texts the way Lingvo sorts them, ignoring case and accents
+int compareHeadings(std::u16string_view left, std::u16string_view right);
 typedef std::vector<ArticleHeading>::iterator ArticleHeadingIter;
 void foreachReferenceSet(std::vector<ArticleHeading>& groupedHeadings,
                          std::function<void(ArticleHeadingIter, ArticleHeadingIter)> func,
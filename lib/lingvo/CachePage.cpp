@@ -2,18 +2,9 @@
 #include "common/BitStream.h"
 #include "IDictionaryDecoder.h"
 
-namespace lingvo {
+#include <algorithm>
 
-bool CachePage::loadHeader(common::IBitStream &bstr) {
-    _isLeaf = bstr.read(1);
-    _number = bstr.read(16);
-    _prev = bstr.read(16);
-    _parent = bstr.read(16);
-    _next = bstr.read(16);
-    _headingsCount = bstr.read(16);
-    bstr.toNearestByte();
-    return true;
-}
+namespace lingvo {
 
 bool CachePage::isLeaf() const {
     return _isLeaf;
@@ -39,13 +30,14 @@ unsigned CachePage::headingsCount() const {
     return _headingsCount;
 }
 
-NodePageBody parseNodePageBody(
-        common::IBitStream &bstr,
-        IDictionaryDecoder& decoder,
-        unsigned count)
-{
+// The prefixes are front coded like the headings of a leaf page, each one
+// shares prefixLen characters with the previous one.
+template <common::BitReader Reader>
+NodePageBody parseNodePage(Reader& bstr, IDictionaryDecoder const& decoder, unsigned count) {
     NodePageBody res;
     decoder.ReadReference1(bstr, res.firstChild);
+    std::u16string knownPrefix;
+    std::u16string postfix;
     for (unsigned i = 0; i < count; ++i) {
         if (i == count - 1) {
             res.prefixes.push_back(u"");
@@ -55,17 +47,34 @@ NodePageBody parseNodePageBody(
         decoder.DecodePrefixLen(bstr, prefixLen);
         unsigned postfixLen;
         decoder.DecodePostfixLen(bstr, postfixLen);
-        std::u16string heading;
-        decoder.DecodeHeading(&bstr, postfixLen, heading);
-        res.prefixes.push_back(heading);
+        decoder.DecodeHeading(&bstr, postfixLen, postfix);
+        knownPrefix.resize(std::min<size_t>(prefixLen, knownPrefix.size()));
+        knownPrefix += postfix;
+        res.prefixes.push_back(knownPrefix);
     }
     return res;
 }
 
+NodePageBody parseNodePageBody(
+        common::IBitStream &bstr,
+        IDictionaryDecoder const& decoder,
+        unsigned count)
+{
+    return parseNodePage(bstr, decoder, count);
+}
+
+NodePageBody parseNodePageBody(
+        common::MemoryBitReader &bstr,
+        IDictionaryDecoder const& decoder,
+        unsigned count)
+{
+    return parseNodePage(bstr, decoder, count);
+}
+
 
 std::vector<ArticleHeading> parseLeafPageBody(
         common::IBitStream &bstr,
-        IDictionaryDecoder &decoder,
+        IDictionaryDecoder const& decoder,
         unsigned count,
         std::u16string knownPrefix)
 {
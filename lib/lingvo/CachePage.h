@@ -18,7 +18,8 @@ class CachePage {
     unsigned _parent;
     unsigned _headingsCount;
 public:
-    bool loadHeader(common::IBitStream& bstr);
+    template <common::BitReader Reader>
+    bool loadHeader(Reader& bstr);
     bool isLeaf() const;
     unsigned number() const;
     unsigned prev() const;
@@ -28,12 +29,25 @@ public:
     unsigned firstChild() const;
 };
 
+template <common::BitReader Reader>
+bool CachePage::loadHeader(Reader &bstr) {
+    _isLeaf = bstr.read(1);
+    _number = bstr.read(16);
+    _prev = bstr.read(16);
+    _parent = bstr.read(16);
+    _next = bstr.read(16);
+    _headingsCount = bstr.read(16);
+    bstr.toNearestByte();
+    return true;
+}
+
 struct NodePageBody {
     unsigned firstChild;
     std::vector<std::u16string> prefixes;
 };
 
-std::vector<ArticleHeading> parseLeafPageBody(common::IBitStream& bstr, IDictionaryDecoder& decoder, unsigned count, std::u16string knownPrefix);
-NodePageBody parseNodePageBody(common::IBitStream& bstr, IDictionaryDecoder& decoder, unsigned count);
+std::vector<ArticleHeading> parseLeafPageBody(common::IBitStream& bstr, IDictionaryDecoder const& decoder, unsigned count, std::u16string knownPrefix);
+NodePageBody parseNodePageBody(common::IBitStream& bstr, IDictionaryDecoder const& decoder, unsigned count);
+NodePageBody parseNodePageBody(common::MemoryBitReader& bstr, IDictionaryDecoder const& decoder, unsigned count);
 
 }
@@ -1,5 +1,6 @@
 #include "DictionaryReader.h"
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include "UserDictionaryDecoder.h"
 #include "SystemDictionaryDecoder.h"
 #include "AbbreviationDictionaryDecoder.h"
@@ -15,17 +16,24 @@ namespace lingvo {
 void DictionaryReader::loadDecoder() const {
     if (!_isSupported)
         throw std::runtime_error("unsuported dictionary version");
-    if (!_decoderLoaded) {
+    std::call_once(_decoderLoaded, [&] {
+        auto mapped = _bstr->span();
+        if (!mapped.empty()) {
+            common::InMemoryStream ras(mapped.data(), mapped.size());
+            common::BitStreamAdapter bstr(&ras);
+            bstr.seek(_header.dictionaryEncoderOffset);
+            _decoder->Read(&bstr);
+            return;
+        }
         auto pos = _bstr->tell();
         _bstr->seek(_header.dictionaryEncoderOffset);
         _decoder->Read(_bstr);
-        _decoderLoaded = true;
         _bstr->seek(pos);
-    }
+    });
 }
 
 DictionaryReader::DictionaryReader(common::IBitStream *bstr)
-    : _bstr(bstr), _isSupported(true), _decoderLoaded(false)
+    : _bstr(bstr), _isSupported(true)
 {
     _bstr->readSome(&_header, sizeof(LSDHeader));
     if (strcmp("LingVo", _header.magic) != 0)
@@ -85,12 +93,10 @@ std::u16string DictionaryReader::prefix() const {
 }
 
 std::u16string DictionaryReader::annotation() const {
-    loadDecoder();
-    _bstr->seek(_header.annotationOffset);
     std::u16string anno;
-    bool decoded = _decoder->DecodeArticle(_bstr, anno);
-    if (!decoded)
+    decodeAt(*_bstr, _header.annotationOffset, anno, [] {
         throw std::runtime_error("can't decode annotation");
+    });
     return anno;
 }
 
@@ -106,17 +112,41 @@ std::vector<unsigned char> const& DictionaryReader::icon() const {
     return _icon;
 }
 
-std::u16string DictionaryReader::decodeArticle(common::IBitStream &bstr, unsigned reference) {
+template <class Fail>
+void DictionaryReader::decodeAt(common::IBitStream& bstr, unsigned offset, std::u16string& body, Fail fail) const {
     loadDecoder();
-    bstr.seek(header().articlesOffset + reference);
-    std::u16string body;
-    bool res = decoder()->DecodeArticle(&bstr, body);
+    bool res;
+    auto mapped = bstr.span();
+    if (!mapped.empty()) {
+        // a mapped stream is decoded from on several threads without a lock,
+        // so a bad offset must not seek it
+        if (offset >= mapped.size()) {
+            fail();
+            return;
+        }
+        common::MemoryBitReader reader(mapped, offset);
+        res = _decoder->DecodeArticle(&reader, body);
+    } else {
+        bstr.seek(offset);
+        res = _decoder->DecodeArticle(&bstr, body);
+    }
     if (!res)
-        throw std::runtime_error("can't decode article");
+        fail();
+}
+
+std::u16string DictionaryReader::decodeArticle(common::IBitStream &bstr, unsigned reference) const {
+    std::u16string body;
+    decodeArticle(bstr, reference, body);
     return body;
 }
 
-IDictionaryDecoder *DictionaryReader::decoder() {
+void DictionaryReader::decodeArticle(common::IBitStream &bstr, unsigned reference, std::u16string& body) const {
+    decodeAt(bstr, header().articlesOffset + reference, body, [] {
+        throw std::runtime_error("can't decode article");
+    });
+}
+
+IDictionaryDecoder const* DictionaryReader::decoder() const {
     loadDecoder();
     return _decoder.get();
 }
@@ -4,6 +4,7 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <stdexcept>
 
@@ -17,7 +18,7 @@ public:
 class DictionaryReader {
     LSDHeader _header;
     common::IBitStream* _bstr;
-    mutable std::unique_ptr<IDictionaryDecoder> _decoder;
+    std::unique_ptr<IDictionaryDecoder> _decoder;
     unsigned _articlesCount; // not really it seems
     std::u16string _name;
     unsigned _pagesEnd;
@@ -25,8 +26,10 @@ class DictionaryReader {
     std::vector<unsigned char> _icon;
     void readOverlay();
     bool _isSupported;
-    mutable bool _decoderLoaded;
+    mutable std::once_flag _decoderLoaded;
     void loadDecoder() const;
+    template <class Fail>
+    void decodeAt(common::IBitStream& bstr, unsigned offset, std::u16string& body, Fail fail) const;
 public:
     DictionaryReader(common::IBitStream* bitstream);
     bool supported() const;
@@ -37,8 +40,15 @@ public:
     unsigned overlayHeadingsOffset() const;
     unsigned overlayDataOffset() const;
     std::vector<unsigned char> const& icon() const;
-    std::u16string decodeArticle(common::IBitStream& bstr, unsigned reference);
-    IDictionaryDecoder* decoder();
+    // Decoding only reads the decoder tables, and over a memory-mapped
+    // dictionary it reads through a cursor of its own instead of seeking bstr,
+    // so several threads can decode articles at once.
+    std::u16string decodeArticle(common::IBitStream& bstr, unsigned reference) const;
+    // reuses the capacity of body, so decoding many articles into the same
+    // string stops allocating once it has grown to the longest one
+    void decodeArticle(common::IBitStream& bstr, unsigned reference, std::u16string& body) const;
+    // loaded once, on the first call, and not modified afterwards
+    IDictionaryDecoder const* decoder() const;
     LSDHeader const& header() const;
 };
 
@@ -0,0 +1,199 @@
+#include "HeadingIndex.h"
+#include "lsd.h"
+#include "common/CommonTools.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string.h>
+
+namespace lingvo {
+
+namespace {
+
+// followed by the offsets of the headings into the characters and of their
+// texts into the keys (count + 1 each), the article references, the
+// characters, the keys and a byte of flags per character
+struct IndexHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t dictionaryVersion;
+    uint32_t checksum;
+    uint32_t count;
+    uint32_t charsCount;
+    uint32_t keysCount;
+};
+
+constexpr char indexMagic[8] = "LSDIDX";
+constexpr uint32_t indexFormatVersion = 2;
+constexpr uint8_t sortedFlag = 1;
+constexpr uint8_t escapedFlag = 2;
+
+template <class T>
+std::span<const T> take(std::span<const uint8_t>& data, size_t count) {
+    if (data.size() < count * sizeof(T))
+        throw std::runtime_error("truncated heading index");
+    std::span<const T> res(reinterpret_cast<const T*>(data.data()), count);
+    data = data.subspan(count * sizeof(T));
+    return res;
+}
+
+}
+
+HeadingIndex::HeadingIndex(std::filesystem::path path, LSDHeader const& header)
+    : _file(path)
+{
+    auto data = _file.span();
+    auto indexHeader = take<IndexHeader>(data, 1)[0];
+    if (memcmp(indexHeader.magic, indexMagic, sizeof(indexMagic)) != 0 ||
+        indexHeader.formatVersion != indexFormatVersion)
+        throw std::runtime_error("not a heading index");
+    if (indexHeader.dictionaryVersion != header.version ||
+        indexHeader.checksum != header.checksum ||
+        indexHeader.count != header.entriesCount)
+        throw std::runtime_error("the heading index belongs to another dictionary");
+    _offsets = take<uint32_t>(data, indexHeader.count + 1);
+    _keyOffsets = take<uint32_t>(data, indexHeader.count + 1);
+    _references = take<uint32_t>(data, indexHeader.count);
+    _chars = take<char16_t>(data, indexHeader.charsCount);
+    _keys = take<char16_t>(data, indexHeader.keysCount);
+    _flags = take<uint8_t>(data, indexHeader.charsCount);
+    if (!data.empty() ||
+        _offsets.back() != indexHeader.charsCount ||
+        _keyOffsets.back() != indexHeader.keysCount ||
+        !std::is_sorted(begin(_offsets), end(_offsets)) ||
+        !std::is_sorted(begin(_keyOffsets), end(_keyOffsets)))
+        throw std::runtime_error("corrupted heading index");
+}
+
+size_t HeadingIndex::size() const {
+    return _references.size();
+}
+
+std::u16string_view HeadingIndex::key(size_t index) const {
+    return {_keys.data() + _keyOffsets[index], _keyOffsets[index + 1] - _keyOffsets[index]};
+}
+
+size_t HeadingIndex::lowerBound(std::u16string_view text) const {
+    size_t first = 0;
+    size_t count = size();
+    while (count > 0) {
+        auto step = count / 2;
+        if (compareHeadings(key(first + step), text) < 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+ArticleHeading HeadingIndex::heading(size_t index) const {
+    ArticleHeading heading;
+    heading._reference = _references[index];
+    for (auto i = _offsets[index]; i < _offsets[index + 1]; ++i) {
+        heading._chars.push_back({bool(_flags[i] & sortedFlag), bool(_flags[i] & escapedFlag), _chars[i]});
+    }
+    return heading;
+}
+
+std::optional<ArticleHeading> HeadingIndex::find(std::u16string_view text) const {
+    auto first = lowerBound(text);
+    for (auto i = first; i < size() && compareHeadings(key(i), text) == 0; ++i) {
+        if (key(i) == text)
+            return heading(i);
+    }
+    if (first < size() && compareHeadings(key(first), text) == 0)
+        return heading(first);
+    return {};
+}
+
+std::vector<ArticleHeading> HeadingIndex::prefixSearch(std::u16string_view prefix, size_t limit) const {
+    std::vector<ArticleHeading> res;
+    for (auto i = lowerBound(prefix); i < size() && res.size() < limit; ++i) {
+        if (compareHeadings(key(i).substr(0, prefix.size()), prefix) != 0)
+            break;
+        res.push_back(heading(i));
+    }
+    return res;
+}
+
+void HeadingIndex::write(LSDDictionary const& dictionary, std::filesystem::path path) {
+    auto headings = dictionary.readHeadings();
+    std::vector<std::u16string> texts;
+    for (auto& heading : headings) {
+        texts.push_back(heading.text());
+    }
+    std::vector<uint32_t> order(headings.size());
+    std::iota(begin(order), end(order), 0);
+    std::stable_sort(begin(order), end(order), [&](auto a, auto b) {
+        return compareHeadings(texts[a], texts[b]) < 0;
+    });
+
+    std::vector<uint32_t> offsets{0};
+    std::vector<uint32_t> keyOffsets{0};
+    std::vector<uint32_t> references;
+    std::u16string chars;
+    std::u16string keys;
+    std::vector<uint8_t> flags;
+    for (auto i : order) {
+        for (auto const& info : headings[i]._chars) {
+            chars += info.chr;
+            flags.push_back((info.sorted ? sortedFlag : 0) | (info.escaped ? escapedFlag : 0));
+        }
+        keys += texts[i];
+        offsets.push_back(chars.size());
+        keyOffsets.push_back(keys.size());
+        references.push_back(headings[i].articleReference());
+    }
+
+    IndexHeader header{};
+    memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.formatVersion = indexFormatVersion;
+    header.dictionaryVersion = dictionary.header().version;
+    header.checksum = dictionary.header().checksum;
+    header.count = headings.size();
+    header.charsCount = chars.size();
+    header.keysCount = keys.size();
+
+    // written under a name of its own first, so that a reader never maps a
+    // partially written index
+    auto tempPath = path;
+    tempPath += fmt::format(".{:x}.tmp", std::random_device()());
+    {
+        auto file = openForWriting(tempPath);
+        auto put = [&](auto const* data, size_t count) {
+            file.write(reinterpret_cast<const char*>(data), count * sizeof(*data));
+        };
+        put(&header, 1);
+        put(offsets.data(), offsets.size());
+        put(keyOffsets.data(), keyOffsets.size());
+        put(references.data(), references.size());
+        put(chars.data(), chars.size());
+        put(keys.data(), keys.size());
+        put(flags.data(), flags.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tempPath);
+            throw std::runtime_error(
+                fmt::format("Can't write heading index: {}", path.u8string()));
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        throw std::runtime_error(
+            fmt::format("Can't write heading index: {}", path.u8string()));
+    }
+}
+
+std::filesystem::path HeadingIndex::sidecarPath(std::filesystem::path lsdPath) {
+    lsdPath += ".idx";
+    return lsdPath;
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ArticleHeading.h"
+#include "common/BitStream.h"
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace lingvo {
+
+struct LSDHeader;
+class LSDDictionary;
+
+// A sidecar file next to a dictionary (<dict>.lsd.idx) that holds all of
+// its headings sorted by compareHeadings, each with its article reference,
+// so that the dictionary can be searched again without decoding its heading
+// pages. The file is memory mapped and stays valid for the dictionary
+// version and checksum it was written for. The decoder tables are not part
+// of it: reading them from the dictionary takes about 20 microseconds, as
+// long as decoding a hundred headings.
+class HeadingIndex {
+    common::MappedFileStream _file;
+    std::span<const uint32_t> _offsets;
+    std::span<const uint32_t> _keyOffsets;
+    std::span<const uint32_t> _references;
+    std::span<const char16_t> _chars;
+    std::span<const char16_t> _keys;
+    std::span<const uint8_t> _flags;
+    std::u16string_view key(size_t index) const;
+    size_t lowerBound(std::u16string_view text) const;
+public:
+    // throws if the file is not an index of the dictionary with this header
+    HeadingIndex(std::filesystem::path path, LSDHeader const& header);
+    size_t size() const;
+    ArticleHeading heading(size_t index) const;
+    // like LSDDictionary::find and prefixSearch, but the prefix matches come
+    // in the order of compareHeadings, which may differ from the page order
+    // for headings with punctuation
+    std::optional<ArticleHeading> find(std::u16string_view text) const;
+    std::vector<ArticleHeading> prefixSearch(std::u16string_view prefix, size_t limit) const;
+    // replaces the file at path atomically
+    static void write(LSDDictionary const& dictionary, std::filesystem::path path);
+    static std::filesystem::path sidecarPath(std::filesystem::path lsdPath);
+};
+
+}
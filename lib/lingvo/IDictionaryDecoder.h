@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include <string>
 
 namespace lingvo {
@@ -9,13 +10,20 @@ class IDictionaryDecoder {
 public:
     virtual ~IDictionaryDecoder();
     virtual void Read(common::IBitStream* bstr) = 0;
-    virtual void DecodeHeading(common::IBitStream* bstr, unsigned len, std::u16string& body) = 0;
-    virtual bool DecodeArticle(common::IBitStream* bstr, std::u16string& body) = 0;
-    virtual bool DecodePrefixLen(common::IBitStream& bstr, unsigned& len) = 0;
-    virtual bool DecodePostfixLen(common::IBitStream& bstr, unsigned& len) = 0;
-    virtual bool ReadReference1(common::IBitStream& bstr, unsigned& reference) = 0;
-    virtual bool ReadReference2(common::IBitStream& bstr, unsigned& reference) = 0;
-    virtual std::u16string Prefix() = 0;
+    virtual void DecodeHeading(common::IBitStream* bstr, unsigned len, std::u16string& body) const = 0;
+    virtual bool DecodeArticle(common::IBitStream* bstr, std::u16string& body) const = 0;
+    virtual bool DecodePrefixLen(common::IBitStream& bstr, unsigned& len) const = 0;
+    virtual bool DecodePostfixLen(common::IBitStream& bstr, unsigned& len) const = 0;
+    virtual bool ReadReference1(common::IBitStream& bstr, unsigned& reference) const = 0;
+    virtual bool ReadReference2(common::IBitStream& bstr, unsigned& reference) const = 0;
+    // the same over an in-memory dictionary, with the bit reading inlined
+    virtual void DecodeHeading(common::MemoryBitReader* bstr, unsigned len, std::u16string& body) const = 0;
+    virtual bool DecodeArticle(common::MemoryBitReader* bstr, std::u16string& body) const = 0;
+    virtual bool DecodePrefixLen(common::MemoryBitReader& bstr, unsigned& len) const = 0;
+    virtual bool DecodePostfixLen(common::MemoryBitReader& bstr, unsigned& len) const = 0;
+    virtual bool ReadReference1(common::MemoryBitReader& bstr, unsigned& reference) const = 0;
+    virtual bool ReadReference2(common::MemoryBitReader& bstr, unsigned& reference) const = 0;
+    virtual std::u16string Prefix() const = 0;
 };
 
 }
@@ -95,7 +95,7 @@ unsigned LSAReader::entriesCount() const {
 void decodeLSA(std::filesystem::path lsaPath, std::filesystem::path outputPath, Log& log) {
     auto lsaOutputDir = outputPath / lsaPath.filename().replace_extension("extracted");
     std::filesystem::create_directories(lsaOutputDir);
-    common::FileStream bstr(lsaPath);
+    common::MappedFileStream bstr(lsaPath);
     LSAReader reader(&bstr);
     reader.collectHeadings();
     log.resetProgress(lsaPath.filename().u8string(), reader.entriesCount());
@@ -5,13 +5,14 @@
 #include "tools.h"
 
 #include <zlib.h>
+#include <span>
 #include <stdexcept>
 #include <assert.h>
 
 namespace lingvo {
 
 void zlibInflate(std::vector<uint8_t>& res,
-                 std::vector<uint8_t> const& buf,
+                 std::span<const uint8_t> buf,
                  unsigned inflatedSize)
 {
     res.resize(inflatedSize);
@@ -45,6 +46,44 @@ void zlibInflate(std::vector<uint8_t>& res,
     inflateEnd(&strm);
 }
 
+std::optional<OverlayRawEntry> zlibUnwrap(std::span<const uint8_t> buf, unsigned inflatedSize) {
+    // a zlib header, two bytes at least of deflate data and an adler32
+    if (buf.size() < 8)
+        return {};
+    // only a deflate stream without a preset dictionary fits into a zip
+    if ((buf[0] & 0x0f) != Z_DEFLATED || (buf[1] & 0x20))
+        return {};
+
+    z_stream strm{};
+    if (inflateInit(&strm) != Z_OK)
+        throw std::runtime_error("zlib init failed");
+    strm.avail_in = buf.size();
+    strm.next_in = (Bytef*)buf.data();
+
+    uint8_t chunk[1 << 14];
+    auto crc = crc32(0, Z_NULL, 0);
+    int ret;
+    do {
+        strm.avail_out = sizeof(chunk);
+        strm.next_out = chunk;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        crc = crc32(crc, chunk, sizeof(chunk) - strm.avail_out);
+    } while (ret != Z_STREAM_END);
+    auto consumed = strm.total_in;
+    auto inflated = strm.total_out;
+    inflateEnd(&strm);
+    if (ret != Z_STREAM_END || inflated != inflatedSize)
+        return {};
+
+    OverlayRawEntry entry;
+    entry.deflated.assign(begin(buf) + 2, begin(buf) + consumed - 4);
+    entry.crc32 = crc;
+    entry.inflatedSize = inflatedSize;
+    return entry;
+}
+
 LSDOverlayReader::LSDOverlayReader(common::IBitStream* bstr,
                                    DictionaryReader *dictionaryReader)
     : _reader(dictionaryReader), _bstr(bstr)
@@ -55,9 +94,10 @@ std::vector<OverlayHeading> LSDOverlayReader::readHeadings() {
     if (offset == -1u)
         return {};
     _bstr->seek(_reader->overlayHeadingsOffset());
-    _bstr->readSome(&_entriesCount, 4);
+    unsigned entriesCount;
+    _bstr->readSome(&entriesCount, 4);
     std::vector<OverlayHeading> entries;
-    for (unsigned i = 0; i < _entriesCount; ++i) {
+    for (unsigned i = 0; i < entriesCount; ++i) {
         OverlayHeading entry;
         unsigned nameLen = _bstr->read(8);
         entry.name = readUnicodeString(_bstr, nameLen, false);
@@ -72,13 +112,31 @@ std::vector<OverlayHeading> LSDOverlayReader::readHeadings() {
     return entries;
 }
 
-std::vector<uint8_t> LSDOverlayReader::readEntry(OverlayHeading const& heading) {
-    _bstr->seek(heading.offset + _reader->overlayDataOffset());
-    std::vector<uint8_t> slice(heading.streamSize);
+std::span<const uint8_t> LSDOverlayReader::entryStream(OverlayHeading const& heading,
+                                                       std::vector<uint8_t>& slice)
+{
+    auto offset = heading.offset + _reader->overlayDataOffset();
+    auto mapped = _bstr->span();
+    if (!mapped.empty()) {
+        if (offset > mapped.size() || heading.streamSize > mapped.size() - offset)
+            throw std::runtime_error("overlay entry is out of bounds");
+        return mapped.subspan(offset, heading.streamSize);
+    }
+    _bstr->seek(offset);
+    slice.resize(heading.streamSize);
     _bstr->readSome(slice.data(), heading.streamSize);
-    std::vector<uint8_t> res;
-    zlibInflate(res, slice, heading.inflatedSize);
+    return slice;
+}
+
+std::vector<uint8_t> LSDOverlayReader::readEntry(OverlayHeading const& heading) {
+    std::vector<uint8_t> slice, res;
+    zlibInflate(res, entryStream(heading, slice), heading.inflatedSize);
     return res;
 }
 
+std::optional<OverlayRawEntry> LSDOverlayReader::readRawEntry(OverlayHeading const& heading) {
+    std::vector<uint8_t> slice;
+    return zlibUnwrap(entryStream(heading, slice), heading.inflatedSize);
+}
+
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "lsd.h"
+#include <optional>
+#include <span>
 #include <string>
 #include <stdint.h>
 
@@ -9,13 +11,16 @@ namespace lingvo {
 class DictionaryReader;
 class LSDOverlayReader {
     DictionaryReader* _reader;
-    unsigned _entriesCount;
     common::IBitStream* _bstr;
+    std::span<const uint8_t> entryStream(OverlayHeading const& heading, std::vector<uint8_t>& slice);
 public:
     LSDOverlayReader(common::IBitStream* bstr,
                      DictionaryReader* dictionaryReader);
     std::vector<OverlayHeading> readHeadings();
     std::vector<uint8_t> readEntry(OverlayHeading const& heading);
+    // Inflates the entry only to verify it and compute its crc32, the
+    // deflate data itself is returned as it is stored.
+    std::optional<OverlayRawEntry> readRawEntry(OverlayHeading const& heading);
 };
 
 }
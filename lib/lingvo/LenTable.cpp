@@ -12,6 +12,10 @@
 
 namespace lingvo {
 
+// wide enough to resolve nearly every symbol with a single probe,
+// small enough for the root table to stay in L1
+constexpr unsigned maxLookupBits = 10;
+
 int tryGetPairWeight(const std::vector<IdxWeightPair> &pairs, size_t idx) {
     if (idx < pairs.size())
         return pairs.at(idx).weight;
@@ -40,38 +44,39 @@ unsigned LenTable::GetMaxLen() const {
     return maxlen;
 }
 
+// Bit len-1 is set when a code of length len still fits below the child.
+uint64_t LenTable::freeLengths(int child) const {
+    if (child == 0)
+        return ~uint64_t(0);
+    if (child < 0)
+        return 0;
+    return _freeLengths.at(child - 1) << 1;
+}
+
+// Places the symbol at the leftmost free code of the given length, the
+// same code a depth-first search from nodeIdx would find, but descends
+// straight to it using the free lengths of the subtrees.
 bool LenTable::placeSymidx(int symIdx, int nodeIdx, int len) {
-    assert(len > 0);
-    if (len == 1) { // time to place
-        if (nodes.at(nodeIdx).left == 0) {
-            nodes.at(nodeIdx).left = -1 - symIdx;
-            symidx2nodeidx[symIdx] = nodeIdx;
-            return true;
-        }
-        if (nodes.at(nodeIdx).right == 0) {
-            nodes.at(nodeIdx).right = -1 - symIdx;
-            symidx2nodeidx[symIdx] = nodeIdx;
-            return true;
-        }
+    // a corrupt table can ask for any length
+    if (len <= 0 || len > 64 || !((_freeLengths.at(nodeIdx) >> (len - 1)) & 1))
         return false;
+    for (; len > 1; --len) {
+        HuffmanNode& node = nodes.at(nodeIdx);
+        int& child = (freeLengths(node.left) >> (len - 1)) & 1 ? node.left : node.right;
+        if (child == 0) {
+            nodes.at(nextNodePosition) = {0,0,nodeIdx,-1};
+            _freeLengths.at(nextNodePosition) = ~uint64_t(0);
+            child = ++nextNodePosition;
+        }
+        nodeIdx = child - 1;
     }
-    if (nodes.at(nodeIdx).left == 0) {
-        nodes.at(nextNodePosition) = {0,0,nodeIdx,-1};
-        nodes.at(nodeIdx).left = ++nextNodePosition;
-    }
-    if (nodes.at(nodeIdx).left > 0) {
-        if (placeSymidx(symIdx, nodes.at(nodeIdx).left - 1, len - 1))
-            return true;
-    }
-    if (nodes.at(nodeIdx).right == 0) {
-        nodes.at(nextNodePosition) = {0,0,nodeIdx,-1};
-        nodes.at(nodeIdx).right = ++nextNodePosition;
-    }
-    if (nodes.at(nodeIdx).right > 0) {
-        if (placeSymidx(symIdx, nodes.at(nodeIdx).right - 1, len - 1))
-            return true;
+    HuffmanNode& node = nodes.at(nodeIdx);
+    (node.left == 0 ? node.left : node.right) = -1 - symIdx;
+    symidx2nodeidx[symIdx] = nodeIdx;
+    for (int idx = nodeIdx; idx != -1; idx = nodes.at(idx).parent) {
+        _freeLengths[idx] = freeLengths(nodes[idx].left) | freeLengths(nodes[idx].right);
     }
-    return false;
+    return true;
 }
 
 void LenTable::Read(common::IBitStream &bitstr) {
@@ -89,12 +94,87 @@ void LenTable::Read(common::IBitStream &bitstr) {
     nodes.resize(count - 1);
     int rootIdx = nodes.size() - 1;
     nodes.at(rootIdx) = {0,0,-1,-1};
+    _freeLengths.assign(nodes.size(), 0);
+    _freeLengths.at(rootIdx) = ~uint64_t(0);
     nextNodePosition = 0;
     for (int i = 0; i < count; ++i) {
         int symidx = bitstr.read(idxBitSize);
         int len = bitstr.read(bitsPerLen);
         placeSymidx(symidx, rootIdx, len);
     }
+    _freeLengths = {};
+
+    std::vector<unsigned> heights(nodes.size());
+    measureHeight(rootIdx, heights);
+    _lookup.clear();
+    _lookupBits = std::min(heights.at(rootIdx), maxLookupBits);
+    buildLookup(rootIdx, heights);
+}
+
+unsigned LenTable::measureHeight(int nodeIdx, std::vector<unsigned>& heights) const {
+    auto const& node = nodes.at(nodeIdx);
+    auto height = [&](int child) { return child > 0 ? measureHeight(child - 1, heights) : 0u; };
+    return heights[nodeIdx] = 1 + std::max(height(node.left), height(node.right));
+}
+
+void SymbolRunTable::Build(LenTable const& table, std::vector<char32_t> const& symbols) {
+    _bits = table.GetLookupBits();
+    _entries.assign(1u << _bits, {});
+    for (unsigned index = 0; index < _entries.size(); ++index) {
+        auto& entry = _entries[index];
+        unsigned used = 0;
+        while (entry.count < maxRun) {
+            // the bits past the end of the index are unknown and read as zeros,
+            // so only a code that fits in what is left can be taken
+            unsigned prefix = (index << used) & (_entries.size() - 1);
+            auto const& code = table.GetLookupEntry(prefix);
+            if (!code.leaf || used + code.bits > _bits)
+                break;
+            if (code.value >= symbols.size() || symbols[code.value] > 0xffff)
+                break;
+            used += code.bits;
+            entry.syms[entry.count] = symbols[code.value];
+            entry.ends[entry.count] = used;
+            entry.count++;
+        }
+    }
+}
+
+unsigned LenTable::buildLookup(int nodeIdx, std::vector<unsigned> const& heights) {
+    unsigned width = std::min(heights.at(nodeIdx), maxLookupBits);
+    unsigned offset = _lookup.size();
+    _lookup.resize(offset + (1u << width), {0, 0, false});
+    fillLookup(offset, width, nodeIdx, 0, 0, heights);
+    return offset;
+}
+
+void LenTable::fillLookup(unsigned offset,
+                          unsigned width,
+                          int nodeIdx,
+                          unsigned code,
+                          unsigned depth,
+                          std::vector<unsigned> const& heights)
+{
+    auto const& node = nodes.at(nodeIdx);
+    for (unsigned bit = 0; bit < 2; ++bit) {
+        int child = bit ? node.right : node.left;
+        unsigned childCode = (code << 1) | bit;
+        unsigned childDepth = depth + 1;
+        if (child < 0) { // leaf, every index starting with the code maps to it
+            unsigned first = childCode << (width - childDepth);
+            unsigned last = (childCode + 1) << (width - childDepth);
+            for (unsigned i = first; i < last; ++i) {
+                _lookup[offset + i] = {static_cast<unsigned>(-1 - child), static_cast<uint8_t>(childDepth), true};
+            }
+        } else if (child > 0) {
+            if (childDepth == width) {
+                auto subtable = buildLookup(child - 1, heights);
+                _lookup[offset + childCode] = {subtable, static_cast<uint8_t>(std::min(heights.at(child - 1), maxLookupBits)), false};
+            } else {
+                fillLookup(offset, width, child - 1, childCode, childDepth, heights);
+            }
+        }
+    }
 }
 
 std::string dumpNode(int childIdx, int nodeIdx, std::string edgelabel) {
@@ -120,27 +200,4 @@ std::string LenTable::DumpDot() const {
     return res + "}";
 }
 
-int LenTable::Decode(common::IBitStream &bitstr, unsigned &symIdx) const {
-    const HuffmanNode* node = &nodes.back();
-    int len = 0;
-    for (;;) {
-        len++;
-        int bit = bitstr.read(1);
-        if (bit) { // right
-            if (node->right < 0) { // leaf
-                symIdx = -1 - node->right;
-                return len;
-            }
-            node = &nodes.at(node->right - 1);
-        } else { // left
-            if (node->left < 0) { // leaf
-                symIdx = -1 - node->left;
-                return len;
-            }
-            node = &nodes.at(node->left - 1);
-        }
-    }
-    // unreachable
-}
-
 }
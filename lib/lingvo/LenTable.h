@@ -1,7 +1,11 @@
 #pragma once
 
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include <vector>
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
 #include <string>
 #include <stdint.h>
 
@@ -25,7 +29,25 @@ struct HuffmanNode {
     int weight;
 };
 
+// An entry of the lookup tables indexed by the next bits of the stream.
+// A leaf consumes `bits` bits and yields `value` as the symbol index,
+// otherwise `value` is the offset of the next table that is `bits` wide.
+// Unused codes have bits == 0.
+struct HuffmanLookupEntry {
+    unsigned value;
+    uint8_t bits;
+    bool leaf;
+};
+
 class LenTable {
+    std::vector<HuffmanLookupEntry> _lookup;
+    unsigned _lookupBits = 0;
+    std::vector<uint64_t> _freeLengths;
+    uint64_t freeLengths(int child) const;
+    unsigned measureHeight(int nodeIdx, std::vector<unsigned>& heights) const;
+    unsigned buildLookup(int nodeIdx, std::vector<unsigned> const& heights);
+    void fillLookup(unsigned offset, unsigned width, int nodeIdx, unsigned code, unsigned depth,
+                    std::vector<unsigned> const& heights);
 public:
     std::vector<HuffmanNode> nodes;
     std::vector<unsigned> symidx2nodeidx;
@@ -35,8 +57,81 @@ public:
     void Store(common::IBitStream& bitstr) const;
     void Read(common::IBitStream& bitstr);
     std::string DumpDot() const;
-    int Decode(common::IBitStream& bitstr, unsigned& symIdx) const;
+    template <common::BitReader Reader>
+    int Decode(Reader& bitstr, unsigned& symIdx) const;
     bool placeSymidx(int symIdx, int nodeIdx, int len);
+    unsigned GetLookupBits() const { return _lookupBits; }
+    HuffmanLookupEntry const& GetLookupEntry(unsigned index) const { return _lookup.at(index); }
+};
+
+// Emits runs of short-coded 16-bit symbols with a single probe. Each entry
+// holds the symbols that the next GetLookupBits() bits of the stream start
+// with, and the code length consumed after each of them.
+class SymbolRunTable {
+    static constexpr unsigned maxRun = 4;
+    struct Entry {
+        char16_t syms[maxRun];
+        uint8_t ends[maxRun];
+        uint8_t count;
+    };
+    std::vector<Entry> _entries;
+    unsigned _bits = 0;
+public:
+    void Build(LenTable const& table, std::vector<char32_t> const& symbols);
+    template <common::BitReader Reader>
+    void Decode(Reader& bitstr,
+                LenTable const& table,
+                std::vector<char32_t> const& symbols,
+                unsigned len,
+                std::u16string& res) const;
 };
 
+template <common::BitReader Reader>
+int LenTable::Decode(Reader& bitstr, unsigned& symIdx) const {
+    unsigned offset = 0;
+    unsigned width = _lookupBits;
+    int len = 0;
+    for (;;) {
+        auto const& entry = _lookup[offset + bitstr.peek(width)];
+        if (entry.leaf) {
+            bitstr.skip(entry.bits);
+            symIdx = entry.value;
+            return len + entry.bits;
+        }
+        if (!entry.bits)
+            throw std::runtime_error("invalid huffman code");
+        bitstr.skip(width);
+        len += width;
+        offset = entry.value;
+        width = entry.bits;
+    }
+}
+
+template <common::BitReader Reader>
+void SymbolRunTable::Decode(Reader& bitstr,
+                            LenTable const& table,
+                            std::vector<char32_t> const& symbols,
+                            unsigned len,
+                            std::u16string& res) const
+{
+    res.resize(len);
+    unsigned i = 0;
+    while (i < len) {
+        auto const& entry = _entries[bitstr.peek(_bits)];
+        if (entry.count) {
+            unsigned count = std::min<unsigned>(entry.count, len - i);
+            std::copy(entry.syms, entry.syms + count, &res[i]);
+            bitstr.skip(entry.ends[count - 1]);
+            i += count;
+            continue;
+        }
+        // the code is longer than the table, or the symbol is not a char16_t
+        unsigned symIdx;
+        table.Decode(bitstr, symIdx);
+        unsigned sym = symbols.at(symIdx);
+        assert(sym <= 0xffff);
+        res[i++] = (char16_t)sym;
+    }
+}
+
 }
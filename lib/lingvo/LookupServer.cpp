@@ -0,0 +1,393 @@
+#include "LookupServer.h"
+#include "DictionaryReader.h"
+#include "HeadingIndex.h"
+#include "common/CommonTools.h"
+
+#include <condition_variable>
+#include <deque>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+namespace lingvo {
+
+namespace {
+
+struct JsonValue {
+    enum class Type { String, Number, Bool, Null } type;
+    std::u16string string;
+    double number = 0;
+    std::string raw; // as it appeared in the request
+};
+
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?, a number is echoed as it
+// appeared, so anything else would make the response invalid
+bool isJsonNumber(std::string_view text) {
+    size_t pos = 0;
+    auto digits = [&] {
+        auto start = pos;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+            pos++;
+        }
+        return pos - start;
+    };
+    if (pos < text.size() && text[pos] == '-') {
+        pos++;
+    }
+    auto integer = pos;
+    auto integerDigits = digits();
+    if (integerDigits == 0 || (integerDigits > 1 && text[integer] == '0'))
+        return false;
+    if (pos < text.size() && text[pos] == '.') {
+        pos++;
+        if (!digits())
+            return false;
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+        pos++;
+        if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+            pos++;
+        }
+        if (!digits())
+            return false;
+    }
+    return pos == text.size();
+}
+
+// Requests are flat objects, so nested objects and arrays are rejected.
+class JsonReader {
+    std::string_view _text;
+    size_t _pos = 0;
+
+    [[noreturn]] void fail() const {
+        throw std::runtime_error(fmt::format("malformed request at offset {}", _pos));
+    }
+
+    void skipSpace() {
+        while (_pos < _text.size() && std::string_view(" \t\r\n").find(_text[_pos]) != std::string_view::npos) {
+            _pos++;
+        }
+    }
+
+    bool consume(char chr) {
+        skipSpace();
+        if (_pos < _text.size() && _text[_pos] == chr) {
+            _pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char chr) {
+        if (!consume(chr))
+            fail();
+    }
+
+    char16_t hex4() {
+        if (_text.size() - _pos < 4)
+            fail();
+        unsigned res = 0;
+        for (int i = 0; i < 4; ++i) {
+            char chr = _text[_pos++];
+            res <<= 4;
+            if (chr >= '0' && chr <= '9') {
+                res |= chr - '0';
+            } else if (chr >= 'a' && chr <= 'f') {
+                res |= chr - 'a' + 10;
+            } else if (chr >= 'A' && chr <= 'F') {
+                res |= chr - 'A' + 10;
+            } else {
+                fail();
+            }
+        }
+        return res;
+    }
+
+    std::u16string string() {
+        expect('"');
+        std::u16string res;
+        std::string plain;
+        for (;;) {
+            if (_pos == _text.size())
+                fail();
+            char chr = _text[_pos++];
+            if (chr == '"')
+                break;
+            if (chr != '\\') {
+                plain += chr;
+                continue;
+            }
+            if (_pos == _text.size())
+                fail();
+            res += toUtf16(plain);
+            plain.clear();
+            switch (char escaped = _text[_pos++]) {
+            case '"': case '\\': case '/': res += escaped; break;
+            case 'b': res += u'\b'; break;
+            case 'f': res += u'\f'; break;
+            case 'n': res += u'\n'; break;
+            case 'r': res += u'\r'; break;
+            case 't': res += u'\t'; break;
+            case 'u': res += hex4(); break;
+            default: fail();
+            }
+        }
+        res += toUtf16(plain);
+        return res;
+    }
+
+    JsonValue value() {
+        skipSpace();
+        auto start = _pos;
+        JsonValue res;
+        if (_pos < _text.size() && _text[_pos] == '"') {
+            res.type = JsonValue::Type::String;
+            res.string = string();
+        } else if (_text.substr(_pos, 4) == "true" || _text.substr(_pos, 5) == "false") {
+            res.type = JsonValue::Type::Bool;
+            res.number = _text[_pos] == 't';
+            _pos += _text[_pos] == 't' ? 4 : 5;
+        } else if (_text.substr(_pos, 4) == "null") {
+            res.type = JsonValue::Type::Null;
+            _pos += 4;
+        } else {
+            res.type = JsonValue::Type::Number;
+            auto end = _text.find_first_not_of("+-0123456789.eE", _pos);
+            end = end == std::string_view::npos ? _text.size() : end;
+            auto token = std::string(_text.substr(_pos, end - _pos));
+            if (!isJsonNumber(token))
+                fail();
+            size_t parsed = 0;
+            try {
+                res.number = std::stod(token, &parsed);
+            } catch (std::exception&) {
+                fail();
+            }
+            if (parsed != token.size())
+                fail();
+            _pos = end;
+        }
+        res.raw = _text.substr(start, _pos - start);
+        return res;
+    }
+
+public:
+    JsonReader(std::string_view text) : _text(text) { }
+
+    std::map<std::string, JsonValue> object() {
+        std::map<std::string, JsonValue> res;
+        expect('{');
+        if (!consume('}')) {
+            do {
+                skipSpace();
+                auto key = toUtf8(string());
+                expect(':');
+                res[key] = value();
+            } while (consume(','));
+            expect('}');
+        }
+        skipSpace();
+        if (_pos != _text.size())
+            fail();
+        return res;
+    }
+};
+
+std::string quote(std::string_view utf8) {
+    std::string res = "\"";
+    for (char chr : utf8) {
+        switch (chr) {
+        case '"': res += "\\\""; break;
+        case '\\': res += "\\\\"; break;
+        case '\n': res += "\\n"; break;
+        case '\r': res += "\\r"; break;
+        case '\t': res += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(chr) < 0x20) {
+                res += fmt::format("\\u{:04x}", static_cast<int>(chr));
+            } else {
+                res += chr;
+            }
+        }
+    }
+    return res + "\"";
+}
+
+std::string quote(std::u16string const& text) {
+    return quote(toUtf8(text));
+}
+
+}
+
+LookupServer::Dictionary::Dictionary(std::filesystem::path path)
+    : name(path.stem().u8string()), ras(path), bstr(&ras), reader(&bstr) { }
+
+LookupServer::LookupServer(unsigned threads, size_t cacheBudget)
+    : _threads(std::max(threads, 1u)), _cacheBudget(cacheBudget) { }
+
+void LookupServer::addDictionary(std::filesystem::path lsdPath, bool useIndex, Log& log) {
+    std::unique_ptr<Dictionary> dictionary;
+    try {
+        dictionary = std::make_unique<Dictionary>(lsdPath);
+    } catch (NotLSDException&) {
+        throw std::runtime_error(fmt::format("{} is not an LSD dictionary, only LSD dictionaries can be served",
+                                             lsdPath.u8string()));
+    }
+    for (auto& served : _dictionaries) {
+        if (served->name == dictionary->name)
+            throw std::runtime_error(fmt::format("a dictionary named {} is already served", dictionary->name));
+    }
+    if (!dictionary->reader.supported())
+        throw std::runtime_error(fmt::format("unsupported dictionary version: {}", lsdPath.u8string()));
+    dictionary->reader.setArticleCacheBudget(_cacheBudget);
+    if (useIndex) {
+        auto indexPath = HeadingIndex::sidecarPath(lsdPath);
+        try {
+            dictionary->reader.openIndex(indexPath);
+        } catch (std::exception& exc) {
+            log.regular("warning: can't use the index {}, looking headings up without it: {}",
+                        indexPath.u8string(), exc.what());
+        }
+    }
+    _dictionaries.push_back(std::move(dictionary));
+}
+
+std::string LookupServer::handle(std::string_view request) const {
+    std::string id = "null";
+    try {
+        auto fields = JsonReader(request).object();
+        auto field = [&](std::string const& name) -> JsonValue const* {
+            auto it = fields.find(name);
+            return it == end(fields) || it->second.type == JsonValue::Type::Null ? nullptr : &it->second;
+        };
+        auto text = [&](std::string const& name) {
+            auto value = field(name);
+            if (!value || value->type != JsonValue::Type::String)
+                throw std::runtime_error(fmt::format("\"{}\" has to be a string", name));
+            return value->string;
+        };
+        if (auto value = field("id")) {
+            id = value->raw;
+        }
+        auto op = toUtf8(text("op"));
+
+        std::vector<Dictionary const*> dictionaries;
+        if (field("dict")) {
+            auto name = toUtf8(text("dict"));
+            for (auto& dictionary : _dictionaries) {
+                if (dictionary->name == name) {
+                    dictionaries.push_back(dictionary.get());
+                }
+            }
+            if (dictionaries.empty())
+                throw std::runtime_error(fmt::format("unknown dictionary: {}", name));
+        } else {
+            for (auto& dictionary : _dictionaries) {
+                dictionaries.push_back(dictionary.get());
+            }
+        }
+
+        std::vector<std::string> results;
+        if (op == "find") {
+            auto heading = text("heading");
+            for (auto dictionary : dictionaries) {
+                if (auto found = dictionary->reader.find(heading)) {
+                    results.push_back(fmt::format("{{\"dict\": {}, \"heading\": {}, \"article\": {}}}",
+                                                  quote(dictionary->name),
+                                                  quote(found->heading.dslText()),
+                                                  quote(found->article)));
+                }
+            }
+        } else if (op == "prefix") {
+            auto prefix = text("prefix");
+            // checked before the conversion, a double out of the range of
+            // size_t doesn't convert to anything defined
+            const size_t maxLimit = 100000;
+            size_t limit = 10;
+            if (auto value = field("limit")) {
+                if (value->type != JsonValue::Type::Number || !(value->number >= 0 && value->number <= maxLimit))
+                    throw std::runtime_error(fmt::format("\"limit\" has to be a number from 0 to {}", maxLimit));
+                limit = value->number;
+            }
+            for (auto dictionary : dictionaries) {
+                for (auto& heading : dictionary->reader.prefixSearch(prefix, limit)) {
+                    results.push_back(fmt::format("{{\"dict\": {}, \"heading\": {}}}",
+                                                  quote(dictionary->name),
+                                                  quote(heading.dslText())));
+                }
+            }
+        } else if (op == "list") {
+            for (auto dictionary : dictionaries) {
+                results.push_back(fmt::format("{{\"dict\": {}, \"title\": {}, \"headings\": {}}}",
+                                              quote(dictionary->name),
+                                              quote(dictionary->reader.name()),
+                                              dictionary->reader.header().entriesCount));
+            }
+        } else {
+            throw std::runtime_error(fmt::format("unknown op: {}", op));
+        }
+        return fmt::format("{{\"id\": {}, \"results\": [{}]}}", id, fmt::join(results, ", "));
+    } catch (std::exception& e) {
+        return fmt::format("{{\"id\": {}, \"error\": {}}}", id, quote(std::string_view(e.what())));
+    }
+}
+
+void LookupServer::serve(std::istream& in, std::ostream& out) const {
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable taken;
+    std::deque<std::string> requests;
+    bool done = false;
+    std::mutex outMutex;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < _threads; ++i) {
+        workers.emplace_back([&] {
+            for (;;) {
+                std::string request;
+                {
+                    std::unique_lock lock(mutex);
+                    queued.wait(lock, [&] { return done || !requests.empty(); });
+                    if (requests.empty())
+                        return;
+                    request = std::move(requests.front());
+                    requests.pop_front();
+                }
+                taken.notify_one();
+                auto response = handle(request);
+                std::lock_guard lock(outMutex);
+                out << response << '\n';
+                out.flush();
+            }
+        });
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos)
+            continue;
+        {
+            // a few requests per worker are enough to keep them all busy
+            std::unique_lock lock(mutex);
+            taken.wait(lock, [&] { return requests.size() < _threads * 4; });
+            requests.push_back(std::move(line));
+        }
+        queued.notify_one();
+    }
+    {
+        std::lock_guard lock(mutex);
+        done = true;
+    }
+    queued.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "lsd.h"
+#include "common/BitStream.h"
+#include "common/Log.h"
+
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lingvo {
+
+// Answers lookups in a set of LSD dictionaries that stay open, one JSON
+// object per line in both directions:
+//
+//   {"id": 1, "op": "find", "heading": "abc"}
+//   {"id": 2, "op": "prefix", "prefix": "ab", "limit": 10, "dict": "name"}
+//   {"id": 3, "op": "list"}
+//
+// "dict" (the file name without .lsd) limits a request to one dictionary.
+// The response carries the same id and either "results" or "error":
+//
+//   {"id": 1, "results": [{"dict": "name", "heading": "abc", "article": "..."}]}
+//   {"id": 2, "results": [{"dict": "name", "heading": "abc"}]}
+//   {"id": 3, "results": [{"dict": "name", "title": "...", "headings": 100}]}
+//
+// Only LSD dictionaries can be served. Duden dictionaries are converted as a
+// whole through duden::writeDSL and have no lookup support here.
+class LookupServer {
+    struct Dictionary {
+        std::string name;
+        common::MappedFileStream ras;
+        common::BitStreamAdapter bstr;
+        LSDDictionary reader;
+        Dictionary(std::filesystem::path path);
+    };
+    std::vector<std::unique_ptr<Dictionary>> _dictionaries;
+    unsigned _threads;
+    size_t _cacheBudget;
+public:
+    // threads run the requests, each dictionary caches up to cacheBudget
+    // bytes of articles for all of them
+    LookupServer(unsigned threads, size_t cacheBudget);
+    // with useIndex the headings are looked up in a sidecar index next to
+    // the dictionary, see LSDDictionary::openIndex. The index is only a
+    // cache, if it can't be opened or written the failure is logged and the
+    // heading pages are searched instead.
+    void addDictionary(std::filesystem::path lsdPath, bool useIndex, Log& log);
+    // one response line (without the line break) for one request line,
+    // can be called from several threads at once
+    std::string handle(std::string_view request) const;
+    // Reads requests until the end of in and writes each response as soon
+    // as it is ready, so responses can come in a different order than the
+    // requests.
+    void serve(std::istream& in, std::ostream& out) const;
+};
+
+}
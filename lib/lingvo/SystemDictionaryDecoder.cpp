@@ -9,18 +9,14 @@ namespace lingvo {
 SystemDictionaryDecoder::SystemDictionaryDecoder(bool xoring)
     : _xoring(xoring) { }
 
+template <common::BitReader Reader>
 bool SystemDictionaryDecoder::DecodeArticle(
-        common::IBitStream *bstr,
+        Reader *bstr,
         std::u16string &res,
         std::u16string const& prefix,
-        bool xoring,
-        LenTable& ltArticles,
-        std::vector<char32_t>& articleSymbols)
+        LenTable const& ltArticles,
+        std::vector<char32_t> const& articleSymbols)
 {
-    common::XoringStreamAdapter adapter(bstr);
-    if (xoring) {
-        bstr = &adapter;
-    }
     unsigned maxlen = bstr->read(16);
     if (maxlen == 0xFFFF) {
         maxlen = bstr->read(32);
@@ -34,11 +30,11 @@ bool SystemDictionaryDecoder::DecodeArticle(
             if (sym <= 0x3F) {
                 unsigned startIdx = bstr->read(BitLength(prefix.length()));
                 unsigned len = sym + 3;
-                res += prefix.substr(startIdx, len);
+                res.append(prefix, startIdx, len);
             } else {
                 unsigned startIdx = bstr->read(BitLength(maxlen));
                 unsigned len = sym - 0x3d;
-                res += res.substr(startIdx, len);
+                res.append(res, startIdx, len);
             }
         } else {
             res += (char16_t)(sym - 0x80);
@@ -47,6 +43,13 @@ bool SystemDictionaryDecoder::DecodeArticle(
     return true;
 }
 
+template bool SystemDictionaryDecoder::DecodeArticle(
+    common::IBitStream*, std::u16string&, std::u16string const&, LenTable const&, std::vector<char32_t> const&);
+template bool SystemDictionaryDecoder::DecodeArticle(
+    common::MemoryBitReader*, std::u16string&, std::u16string const&, LenTable const&, std::vector<char32_t> const&);
+template bool SystemDictionaryDecoder::DecodeArticle(
+    common::XoringMemoryBitReader*, std::u16string&, std::u16string const&, LenTable const&, std::vector<char32_t> const&);
+
 void SystemDictionaryDecoder::Read(common::IBitStream *bstr) {
     common::XoringStreamAdapter adapter(bstr);
     if (_xoring) {
@@ -58,6 +61,7 @@ void SystemDictionaryDecoder::Read(common::IBitStream *bstr) {
     _headingSymbols = readSymbols(bstr);
     _ltArticles.Read(*bstr);
     _ltHeadings.Read(*bstr);
+    _headingRuns.Build(_ltHeadings, _headingSymbols);
 
     _ltPostfixLengths.Read(*bstr);
     bstr->read(32);
@@ -67,38 +71,68 @@ void SystemDictionaryDecoder::Read(common::IBitStream *bstr) {
     _huffman2Number = bstr->read(32);
 }
 
-void SystemDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) {
-    res.clear();
-    unsigned symIdx;
-    for (size_t i = 0; i < len; i++) {
-        _ltHeadings.Decode(*bstr, symIdx);
-        unsigned sym = _headingSymbols.at(symIdx);
-        assert(sym <= 0xffff);
-        res += (char16_t)sym;
+void SystemDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
+}
+
+bool SystemDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) const {
+    if (_xoring) {
+        std::lock_guard lock(_xoringMutex);
+        if (_xoringAdapter) {
+            _xoringAdapter->attach(bstr);
+        } else {
+            _xoringAdapter = std::make_unique<common::XoringStreamAdapter>(bstr);
+        }
+        return DecodeArticle(_xoringAdapter.get(), res, _prefix, _ltArticles, _articleSymbols);
     }
+    return DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
+}
+
+bool SystemDictionaryDecoder::DecodePrefixLen(common::IBitStream &bstr, unsigned &len) const {
+    return _ltPrefixLengths.Decode(bstr, len);
 }
 
-bool SystemDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) {
-    return DecodeArticle(bstr, res, _prefix, _xoring, _ltArticles, _articleSymbols);
+bool SystemDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) const {
+    return _ltPostfixLengths.Decode(bstr, len);
+}
+
+bool SystemDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman1Number);
+}
+
+bool SystemDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman2Number);
+}
+
+void SystemDictionaryDecoder::DecodeHeading(common::MemoryBitReader *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
+}
+
+bool SystemDictionaryDecoder::DecodeArticle(common::MemoryBitReader *bstr, std::u16string &res) const {
+    if (_xoring) {
+        common::XoringMemoryBitReader xoring(bstr->span(), bstr->tell());
+        return DecodeArticle(&xoring, res, _prefix, _ltArticles, _articleSymbols);
+    }
+    return DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
 }
 
-bool SystemDictionaryDecoder::DecodePrefixLen(common::IBitStream &bstr, unsigned &len) {
+bool SystemDictionaryDecoder::DecodePrefixLen(common::MemoryBitReader &bstr, unsigned &len) const {
     return _ltPrefixLengths.Decode(bstr, len);
 }
 
-bool SystemDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) {
+bool SystemDictionaryDecoder::DecodePostfixLen(common::MemoryBitReader &bstr, unsigned &len) const {
     return _ltPostfixLengths.Decode(bstr, len);
 }
 
-bool SystemDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) {
+bool SystemDictionaryDecoder::ReadReference1(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman1Number);
 }
 
-bool SystemDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) {
+bool SystemDictionaryDecoder::ReadReference2(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman2Number);
 }
 
-std::u16string SystemDictionaryDecoder::Prefix() {
+std::u16string SystemDictionaryDecoder::Prefix() const {
     return _prefix;
 }
 
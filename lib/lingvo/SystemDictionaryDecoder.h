@@ -3,6 +3,8 @@
 #include "IDictionaryDecoder.h"
 #include "LenTable.h"
 
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
@@ -14,28 +16,39 @@ class SystemDictionaryDecoder : public IDictionaryDecoder {
     std::vector<char32_t> _headingSymbols;
     LenTable _ltArticles;
     LenTable _ltHeadings;
+    SymbolRunTable _headingRuns;
     LenTable _ltPrefixLengths;
     LenTable _ltPostfixLengths;
     unsigned _huffman1Number;
     unsigned _huffman2Number;
     bool _xoring;
+    // reused by every article read through an IBitStream, so its buffer is
+    // allocated once
+    mutable std::unique_ptr<common::XoringStreamAdapter> _xoringAdapter;
+    mutable std::mutex _xoringMutex;
 public:
     SystemDictionaryDecoder(bool xoring);
+    template <common::BitReader Reader>
     static bool DecodeArticle(
-        common::IBitStream *bstr,
+        Reader *bstr,
         std::u16string &res,
         std::u16string const& prefix,
-        bool xoring,
-        LenTable& ltArticles,
-        std::vector<char32_t>& articleSymbols);
+        LenTable const& ltArticles,
+        std::vector<char32_t> const& articleSymbols);
     virtual void Read(common::IBitStream* bstr) override;
-    virtual void DecodeHeading(common::IBitStream* bstr, unsigned len, std::u16string& body) override;
-    virtual bool DecodeArticle(common::IBitStream* bstr, std::u16string& body) override;
-    virtual bool DecodePrefixLen(common::IBitStream& bstr, unsigned& len) override;
-    virtual bool DecodePostfixLen(common::IBitStream& bstr, unsigned& len) override;
-    virtual bool ReadReference1(common::IBitStream& bstr, unsigned& reference) override;
-    virtual bool ReadReference2(common::IBitStream& bstr, unsigned& reference) override;
-    virtual std::u16string Prefix() override;
+    virtual void DecodeHeading(common::IBitStream* bstr, unsigned len, std::u16string& body) const override;
+    virtual bool DecodeArticle(common::IBitStream* bstr, std::u16string& body) const override;
+    virtual bool DecodePrefixLen(common::IBitStream& bstr, unsigned& len) const override;
+    virtual bool DecodePostfixLen(common::IBitStream& bstr, unsigned& len) const override;
+    virtual bool ReadReference1(common::IBitStream& bstr, unsigned& reference) const override;
+    virtual bool ReadReference2(common::IBitStream& bstr, unsigned& reference) const override;
+    virtual void DecodeHeading(common::MemoryBitReader* bstr, unsigned len, std::u16string& body) const override;
+    virtual bool DecodeArticle(common::MemoryBitReader* bstr, std::u16string& body) const override;
+    virtual bool DecodePrefixLen(common::MemoryBitReader& bstr, unsigned& len) const override;
+    virtual bool DecodePostfixLen(common::MemoryBitReader& bstr, unsigned& len) const override;
+    virtual bool ReadReference1(common::MemoryBitReader& bstr, unsigned& reference) const override;
+    virtual bool ReadReference2(common::MemoryBitReader& bstr, unsigned& reference) const override;
+    virtual std::u16string Prefix() const override;
 };
 
 }
@@ -11,12 +11,13 @@ namespace lingvo {
 
 UserDictionaryDecoder::UserDictionaryDecoder(bool legacySystem) : _legacySystem(legacySystem) {}
 
+template <common::BitReader Reader>
 bool UserDictionaryDecoder::DecodeArticle(
-        common::IBitStream *bstr,
+        Reader *bstr,
         std::u16string &res,
         std::u16string const& prefix,
-        LenTable& ltArticles,
-        std::vector<char32_t>& articleSymbols)
+        LenTable const& ltArticles,
+        std::vector<char32_t> const& articleSymbols)
 {
     unsigned len = bstr->read(16);
     if (len == 0xFFFF) {
@@ -24,22 +25,18 @@ bool UserDictionaryDecoder::DecodeArticle(
     }
     res.clear();
     unsigned symIdx;
-    std::vector<uint32_t> vec;
     while ((unsigned)res.length() < len) {
         ltArticles.Decode(*bstr, symIdx);
         unsigned sym = articleSymbols.at(symIdx);
-        vec.push_back(sym);
         if (sym >= 0x10000) {
             if (sym >= 0x10040) {
                 unsigned startIdx = bstr->read(BitLength(len));
                 unsigned len = sym - 0x1003d;
-                res += res.substr(startIdx, len);
-                vec.push_back(startIdx);
+                res.append(res, startIdx, len);
             } else {
                 unsigned startIdx = bstr->read(BitLength(prefix.length()));
                 unsigned len = sym - 0xfffd;
-                res += prefix.substr(startIdx, len);
-                vec.push_back(startIdx);
+                res.append(prefix, startIdx, len);
             }
         } else {
             res += (char16_t)sym;
@@ -48,6 +45,11 @@ bool UserDictionaryDecoder::DecodeArticle(
     return true;
 }
 
+template bool UserDictionaryDecoder::DecodeArticle(
+    common::IBitStream*, std::u16string&, std::u16string const&, LenTable const&, std::vector<char32_t> const&);
+template bool UserDictionaryDecoder::DecodeArticle(
+    common::MemoryBitReader*, std::u16string&, std::u16string const&, LenTable const&, std::vector<char32_t> const&);
+
 void UserDictionaryDecoder::Read(common::IBitStream *bstr) {
     int len = bstr->read(32);
     _prefix = readUnicodeString(bstr, len, true);
@@ -55,46 +57,66 @@ void UserDictionaryDecoder::Read(common::IBitStream *bstr) {
     _headingSymbols = readSymbols(bstr);
     _ltArticles.Read(*bstr);
     _ltHeadings.Read(*bstr);
+    _headingRuns.Build(_ltHeadings, _headingSymbols);
     _ltPrefixLengths.Read(*bstr);
     _ltPostfixLengths.Read(*bstr);
     _huffman1Number = bstr->read(32);
     _huffman2Number = bstr->read(32);
 }
 
-void UserDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) {
-    res.clear();
-    unsigned symIdx;
-    for (size_t i = 0; i < len; i++) {
-        _ltHeadings.Decode(*bstr, symIdx);
-        unsigned sym = _headingSymbols.at(symIdx);
-        assert(sym <= 0xffff);
-        res += (char16_t)sym;
-    }
+void UserDictionaryDecoder::DecodeHeading(common::IBitStream *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
+}
+
+bool UserDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) const {
+    if (_legacySystem)
+        return SystemDictionaryDecoder::DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
+    return DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
+}
+
+bool UserDictionaryDecoder::DecodePrefixLen(common::IBitStream& bstr, unsigned &len) const {
+    return _ltPrefixLengths.Decode(bstr, len);
+}
+
+bool UserDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) const {
+    return _ltPostfixLengths.Decode(bstr, len);
+}
+
+bool UserDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman1Number);
+}
+
+bool UserDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) const {
+    return readReference(bstr, reference, _huffman2Number);
+}
+
+void UserDictionaryDecoder::DecodeHeading(common::MemoryBitReader *bstr, unsigned len, std::u16string &res) const {
+    decodeHeading(*bstr, _ltHeadings, _headingRuns, _headingSymbols, len, res);
 }
 
-bool UserDictionaryDecoder::DecodeArticle(common::IBitStream *bstr, std::u16string &res) {
+bool UserDictionaryDecoder::DecodeArticle(common::MemoryBitReader *bstr, std::u16string &res) const {
     if (_legacySystem)
-        return SystemDictionaryDecoder::DecodeArticle(bstr, res, _prefix, false, _ltArticles, _articleSymbols);
+        return SystemDictionaryDecoder::DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
     return DecodeArticle(bstr, res, _prefix, _ltArticles, _articleSymbols);
 }
 
-bool UserDictionaryDecoder::DecodePrefixLen(common::IBitStream& bstr, unsigned &len) {
+bool UserDictionaryDecoder::DecodePrefixLen(common::MemoryBitReader& bstr, unsigned &len) const {
     return _ltPrefixLengths.Decode(bstr, len);
 }
 
-bool UserDictionaryDecoder::DecodePostfixLen(common::IBitStream &bstr, unsigned &len) {
+bool UserDictionaryDecoder::DecodePostfixLen(common::MemoryBitReader &bstr, unsigned &len) const {
     return _ltPostfixLengths.Decode(bstr, len);
 }
 
-bool UserDictionaryDecoder::ReadReference1(common::IBitStream &bstr, unsigned &reference) {
+bool UserDictionaryDecoder::ReadReference1(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman1Number);
 }
 
-bool UserDictionaryDecoder::ReadReference2(common::IBitStream &bstr, unsigned &reference) {
+bool UserDictionaryDecoder::ReadReference2(common::MemoryBitReader &bstr, unsigned &reference) const {
     return readReference(bstr, reference, _huffman2Number);
 }
 
-std::u16string UserDictionaryDecoder::Prefix() {
+std::u16string UserDictionaryDecoder::Prefix() const {
     return _prefix;
 }
 
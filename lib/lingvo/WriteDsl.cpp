@@ -4,25 +4,147 @@
 #include "common/ZipWriter.h"
 #include "tools.h"
 
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
 namespace lingvo {
 
+namespace {
+
+// Decodes articles on worker threads while the calling thread writes them
+// out in the original order. A worker may run at most window articles ahead
+// of the writer, each article has its own slot until it is written.
+class ParallelArticleDecoder {
+    struct Slot {
+        std::u16string article;
+        std::exception_ptr error;
+        bool ready = false;
+    };
+
+    const LSDDictionary* _reader;
+    std::vector<unsigned> const& _references;
+    std::vector<Slot> _slots;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    size_t _next = 0;
+    size_t _written = 0;
+    bool _stop = false;
+    std::vector<std::thread> _workers;
+
+    void work() {
+        for (;;) {
+            size_t index;
+            {
+                std::unique_lock lock(_mutex);
+                _cv.wait(lock, [&] {
+                    return _stop || _next == _references.size() || _next < _written + _slots.size();
+                });
+                if (_stop || _next == _references.size())
+                    return;
+                index = _next++;
+            }
+            auto& slot = _slots[index % _slots.size()];
+            try {
+                _reader->readArticle(_references[index], slot.article);
+            } catch (...) {
+                slot.error = std::current_exception();
+            }
+            {
+                std::lock_guard lock(_mutex);
+                slot.ready = true;
+            }
+            _cv.notify_all();
+        }
+    }
+
+public:
+    ParallelArticleDecoder(const LSDDictionary* reader,
+                           std::vector<unsigned> const& references,
+                           unsigned threads)
+        : _reader(reader), _references(references), _slots(threads * 16)
+    {
+        for (unsigned i = 0; i < threads; ++i) {
+            _workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ParallelArticleDecoder(ParallelArticleDecoder const&) = delete;
+    ParallelArticleDecoder& operator=(ParallelArticleDecoder const&) = delete;
+
+    // blocks until the next article is decoded
+    std::u16string const& next() {
+        auto& slot = _slots[_written % _slots.size()];
+        std::unique_lock lock(_mutex);
+        _cv.wait(lock, [&] { return slot.ready; });
+        if (slot.error)
+            std::rethrow_exception(slot.error);
+        return slot.article;
+    }
+
+    // releases the slot returned by next()
+    void release() {
+        {
+            std::lock_guard lock(_mutex);
+            _slots[_written % _slots.size()].ready = false;
+            _written++;
+        }
+        _cv.notify_all();
+    }
+
+    ~ParallelArticleDecoder() {
+        {
+            std::lock_guard lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+};
+
+}
+
 void writeDSL(const LSDDictionary* reader,
               std::filesystem::path lsdName,
               std::filesystem::path outputPath,
               bool dumb,
-              Log& log)
+              Log& log,
+              unsigned threads,
+              int zipLevel)
 {
     dsl::Writer writer(outputPath, lsdName.replace_extension().u8string());
     std::filesystem::path overlayPath = std::filesystem::u8path(writer.dslFilePath().u8string() + ".files.zip");
 
+    auto writeOverlay = [&](auto& zip, std::vector<OverlayHeading> const& overlayHeadings) {
+        for (OverlayHeading heading : overlayHeadings) {
+            // the entries are zlib streams already, so their deflate data
+            // goes into the zip without being compressed again
+            if (auto raw = reader->readOverlayRawEntry(heading)) {
+                zip.addRawFile(toUtf8(heading.name), raw->deflated.data(), raw->deflated.size(),
+                               raw->crc32, raw->inflatedSize);
+            } else {
+                std::vector<uint8_t> entry = reader->readOverlayEntry(heading);
+                zip.addFile(toUtf8(heading.name), entry.data(), entry.size());
+            }
+            log.advance();
+        }
+    };
+
     auto overlayHeadings = reader->readOverlayHeadings();
     if (overlayHeadings.size() > 0) {
         log.resetProgress("overlay", overlayHeadings.size());
-        ZipWriter zip(overlayPath);
-        for (OverlayHeading heading : overlayHeadings) {
-            std::vector<uint8_t> entry = reader->readOverlayEntry(heading);
-            zip.addFile(toUtf8(heading.name), entry.data(), entry.size());
-            log.advance();
+        if (threads > 1) {
+            ParallelZipWriter zip(overlayPath, threads, zipLevel);
+            writeOverlay(zip, overlayHeadings);
+            zip.finish();
+        } else {
+            ZipWriter zip(overlayPath, zipLevel);
+            writeOverlay(zip, overlayHeadings);
+            zip.close();
         }
     }
 
@@ -31,34 +153,121 @@ void writeDSL(const LSDDictionary* reader,
         writer.setAnnotation(annoStr);
     }
 
-    auto headings = reader->readHeadings();
+    auto writeHeader = [&] {
+        writer.setName(reader->name());
+        writer.setLanguage(reader->header().sourceLanguage, reader->header().targetLanguage);
+        auto iconArr = reader->icon();
+        if (!iconArr.empty()) {
+            writer.setIcon(iconArr);
+        }
+        writer.writeNewLine();
+    };
+
+    // Without grouping every heading is written with its own article as soon
+    // as it is read, so the headings are never held in memory all at once.
+    // A decoding error is only noticed after the .dsl is written then, it is
+    // removed so that no incomplete dictionary is left behind.
+    if (dumb && threads <= 1) {
+        try {
+            writeHeader();
+            log.resetProgress(writer.dslFileName().u8string(), reader->header().entriesCount);
+            auto cursor = reader->headingCursor();
+            std::u16string article;
+            unsigned count = 0;
+            while (auto heading = cursor.next()) {
+                writer.writeHeading(heading->dslText());
+                log.advance();
+                reader->readArticle(heading->articleReference(), article);
+                writer.writeArticle(article);
+                count++;
+            }
+            if (count != reader->header().entriesCount) {
+                throw std::runtime_error("decoding error");
+            }
+        } catch (...) {
+            writer.discard();
+            throw;
+        }
+        writer.flush();
+        return;
+    }
+
+    auto headings = reader->readHeadingStore(threads);
     if (headings.size() != reader->header().entriesCount) {
         throw std::runtime_error("decoding error");
     }
 
-    if (!dumb) {
+    // The headings of every article are written together, articles in the
+    // order of their first heading, as groupHeadingsByReference does.
+    // Variants are collapsed one reference set at a time, so only the
+    // headings of the current set are ever turned into ArticleHeadings.
+    std::vector<uint32_t> order(headings.size());
+    if (dumb) {
+        std::iota(begin(order), end(order), 0);
+    } else {
         log.regular("collapsing variant headings");
-        collapseVariants(headings);
+        order = referenceSetOrder(headings.size(), [&](size_t i) { return headings.articleReference(i); });
     }
-
-    writer.setName(reader->name());
-    writer.setLanguage(reader->header().sourceLanguage, reader->header().targetLanguage);
-    auto iconArr = reader->icon();
-    if (!iconArr.empty()) {
-        writer.setIcon(iconArr);
+    std::vector<uint32_t> setStarts;
+    std::vector<unsigned> references;
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        auto reference = headings.articleReference(order[i]);
+        if (dumb || i == 0 || reference != references.back()) {
+            setStarts.push_back(i);
+            references.push_back(reference);
+        }
     }
-    writer.writeNewLine();
+    setStarts.push_back(order.size());
 
-    log.resetProgress(writer.dslFileName().u8string(), headings.size());
-    foreachReferenceSet(headings, [&](auto first, auto last) {
+    writeHeader();
+
+    std::vector<ArticleHeading> variants;
+    auto writeHeadings = [&](size_t set) {
+        auto first = begin(order) + setStarts[set];
+        auto last = begin(order) + setStarts[set + 1];
+        if (dumb || last - first == 1) {
+            for (auto it = first; it != last; ++it) {
+                writer.writeHeading(headings.dslText(*it));
+                log.advance();
+            }
+            return;
+        }
+        variants.clear();
         for (auto it = first; it != last; ++it) {
-            const std::u16string& headingText = it->dslText();
-            writer.writeHeading(headingText);
+            variants.push_back(headings.heading(*it));
             log.advance();
         }
-        std::u16string article = reader->readArticle(first->articleReference());
-        writer.writeArticle(article);
-    }, dumb);
+        collapseVariantSet(variants);
+        for (auto& heading : variants) {
+            writer.writeHeading(heading.dslText());
+        }
+    };
+
+    log.resetProgress(writer.dslFileName().u8string(), headings.size());
+    // the dictionary decodes articles on several threads at once only when
+    // it is mapped into memory
+    if (threads > 1 && reader->span().empty()) {
+        log.verbose("the dictionary is not mapped into memory, decoding articles on one thread");
+        threads = 1;
+    }
+    if (threads <= 1) {
+        std::u16string article;
+        for (size_t set = 0; set < references.size(); ++set) {
+            writeHeadings(set);
+            reader->readArticle(references[set], article);
+            writer.writeArticle(article);
+        }
+        writer.flush();
+        return;
+    }
+
+    ParallelArticleDecoder decoder(reader, references, threads);
+    for (size_t set = 0; set < references.size(); ++set) {
+        writeHeadings(set);
+        writer.writeArticle(decoder.next());
+        decoder.release();
+    }
+    writer.flush();
 }
 
 }
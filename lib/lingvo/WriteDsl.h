@@ -10,6 +10,8 @@ void writeDSL(const lingvo::LSDDictionary* reader,
               std::filesystem::path lsdName,
               std::filesystem::path outputPath,
               bool dumb,
-              Log& log);
+              Log& log,
+              unsigned threads = 1,
+              int zipLevel = -1);
 
 }
@@ -3,26 +3,229 @@
 #include "DictionaryReader.h"
 #include "IDictionaryDecoder.h"
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include "CachePage.h"
+#include "HeadingIndex.h"
 #include "LSDOverlayReader.h"
 
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
 
 namespace lingvo {
 
-std::vector<ArticleHeading> collectHeadingFromPage(common::IBitStream& bstr, DictionaryReader& reader, unsigned pageNumber) {
-    std::vector<ArticleHeading> res;
+template <common::BitReader Reader>
+void loadHeading(std::vector<ArticleHeading>& res, IDictionaryDecoder const& decoder, Reader& bstr, std::u16string& prefix) {
+    res.emplace_back().Load(decoder, bstr, prefix);
+}
+
+template <common::BitReader Reader>
+void loadHeading(HeadingStore& res, IDictionaryDecoder const& decoder, Reader& bstr, std::u16string& prefix) {
+    res.Load(decoder, bstr, prefix);
+}
+
+static void appendHeadings(std::vector<ArticleHeading>& res, std::vector<ArticleHeading>& page) {
+    std::move(begin(page), end(page), back_inserter(res));
+}
+
+static void appendHeadings(HeadingStore& res, HeadingStore& page) {
+    res.append(page);
+}
+
+constexpr unsigned noPage = 0xffff;
+
+// leaves the stream at the start of the page body
+template <common::BitReader Reader>
+CachePage loadPageHeader(Reader& bstr, DictionaryReader& reader, unsigned pageNumber) {
+    if (pageNumber >= reader.pagesCount())
+        throw std::runtime_error("invalid page number");
     bstr.seek(reader.header().pagesOffset + 512 * pageNumber);
     CachePage page;
     page.loadHeader(bstr);
+    return page;
+}
+
+template <common::BitReader Reader, class Headings>
+CachePage collectHeadingFromPage(Reader& bstr,
+                                 DictionaryReader& reader,
+                                 unsigned pageNumber,
+                                 Headings& res)
+{
+    auto page = loadPageHeader(bstr, reader, pageNumber);
     if (page.isLeaf()) {
         std::u16string prefix;
         for (size_t idx = 0; idx < page.headingsCount(); ++idx) {
-            ArticleHeading h;
-            h.Load(*reader.decoder(), bstr, prefix);
-            res.push_back(h);
+            loadHeading(res, *reader.decoder(), bstr, prefix);
         }
     }
+    return page;
+}
+
+HeadingCursor::HeadingCursor(DictionaryReader* reader, common::IBitStream* bstr)
+    : _reader(reader), _bstr(bstr) { }
+
+bool HeadingCursor::loadPage() {
+    _headings.clear();
+    _pos = 0;
+    auto mapped = _bstr->span();
+    while (_headings.empty() && _page < _reader->pagesCount()) {
+        if (mapped.empty()) {
+            collectHeadingFromPage(*_bstr, *_reader, _page++, _headings);
+        } else {
+            common::MemoryBitReader bstr(mapped);
+            collectHeadingFromPage(bstr, *_reader, _page++, _headings);
+        }
+    }
+    return !_headings.empty();
+}
+
+ArticleHeading* HeadingCursor::next() {
+    if (_pos == _headings.size() && !loadPage())
+        return nullptr;
+    return &_headings[_pos++];
+}
+
+// The number of the leftmost leaf page that text can be in. The root is the
+// only page without a parent. The children of a node page are the consecutive
+// pages from firstChild on, the child at index i holds the headings that sort
+// before the i-th prefix, the last child (with an empty prefix) the rest. A
+// heading that sorts equal to a prefix can be on either side of it. Nothing is
+// returned if the prefixes are not in the order of compareHeadings, the tree
+// can't be searched then.
+template <common::BitReader Reader>
+std::optional<unsigned> findLeafPage(Reader& bstr, DictionaryReader& reader, std::u16string_view text) {
+    unsigned number = 0;
+    auto page = loadPageHeader(bstr, reader, number);
+    for (unsigned depth = 0; page.parent() != noPage; ++depth) {
+        if (depth == reader.pagesCount())
+            throw std::runtime_error("invalid heading tree");
+        number = page.parent();
+        page = loadPageHeader(bstr, reader, number);
+    }
+    for (unsigned depth = 0; !page.isLeaf(); ++depth) {
+        if (depth == reader.pagesCount() || page.headingsCount() == 0)
+            throw std::runtime_error("invalid heading tree");
+        auto body = parseNodePageBody(bstr, *reader.decoder(), page.headingsCount());
+        for (size_t i = 1; i + 1 < body.prefixes.size(); ++i) {
+            if (compareHeadings(body.prefixes[i - 1], body.prefixes[i]) > 0)
+                return {};
+        }
+        unsigned child = 0;
+        while (child + 1 < body.prefixes.size() && compareHeadings(text, body.prefixes[child]) > 0) {
+            child++;
+        }
+        auto parent = number;
+        number = body.firstChild + child;
+        page = loadPageHeader(bstr, reader, number);
+        if (page.parent() != parent)
+            throw std::runtime_error("invalid heading tree");
+    }
+    return number;
+}
+
+// Passes the headings to visit(heading, text) in page order, starting in the
+// leftmost leaf page that text can be in, until visit returns false. Returns
+// false if the headings of the pages read on the way are not in the order of
+// compareHeadings, which means that Lingvo sorted them differently and the
+// B-tree can't be relied on.
+template <common::BitReader Reader, class Visit>
+bool walkLeafPages(Reader& bstr, DictionaryReader& reader, std::u16string_view text, Visit visit) {
+    auto number = findLeafPage(bstr, reader, text);
+    if (!number)
+        return false;
+    std::vector<ArticleHeading> headings;
+    std::vector<std::u16string> texts;
+    std::optional<std::u16string> previous;
+    for (unsigned pages = 0; *number != noPage; ++pages) {
+        if (pages == reader.pagesCount())
+            throw std::runtime_error("invalid heading tree");
+        headings.clear();
+        texts.clear();
+        auto page = collectHeadingFromPage(bstr, reader, *number, headings);
+        for (auto& heading : headings) {
+            auto headingText = heading.text();
+            if (previous && compareHeadings(*previous, headingText) > 0)
+                return false;
+            previous = headingText;
+            texts.push_back(std::move(headingText));
+        }
+        for (size_t i = 0; i < headings.size(); ++i) {
+            if (!visit(headings[i], texts[i]))
+                return true;
+        }
+        number = page.next();
+    }
+    return true;
+}
+
+// the same over every leaf page, for when the B-tree can't be relied on
+template <common::BitReader Reader, class Visit>
+void scanLeafPages(Reader& bstr, DictionaryReader& reader, Visit visit) {
+    std::vector<ArticleHeading> headings;
+    for (unsigned number = 0; number < reader.pagesCount(); ++number) {
+        headings.clear();
+        collectHeadingFromPage(bstr, reader, number, headings);
+        for (auto& heading : headings) {
+            if (!visit(heading, heading.text()))
+                return;
+        }
+    }
+}
+
+// An exact match is preferred over one that only sorts equal.
+template <common::BitReader Reader>
+std::optional<ArticleHeading> findHeading(Reader& bstr, DictionaryReader& reader, std::u16string_view text) {
+    std::optional<ArticleHeading> exact;
+    std::optional<ArticleHeading> folded;
+    auto match = [&](ArticleHeading& heading, std::u16string const& headingText) {
+        if (headingText == text) {
+            exact = std::move(heading);
+            return false;
+        }
+        if (!folded) {
+            folded = heading;
+        }
+        return true;
+    };
+    bool ordered = walkLeafPages(bstr, reader, text, [&](auto& heading, auto const& headingText) {
+        int order = compareHeadings(headingText, text);
+        return order < 0 || (order == 0 && match(heading, headingText));
+    });
+    if (!ordered) {
+        exact.reset();
+        folded.reset();
+        scanLeafPages(bstr, reader, [&](auto& heading, auto const& headingText) {
+            return compareHeadings(headingText, text) != 0 || match(heading, headingText);
+        });
+    }
+    return exact ? exact : folded;
+}
+
+// The matching headings are contiguous in page order.
+template <common::BitReader Reader>
+std::vector<ArticleHeading> searchPrefix(Reader& bstr, DictionaryReader& reader, std::u16string_view prefix, size_t limit) {
+    std::vector<ArticleHeading> res;
+    if (limit == 0)
+        return res;
+    auto order = [&](std::u16string const& headingText) {
+        return compareHeadings(std::u16string_view(headingText).substr(0, prefix.size()), prefix);
+    };
+    auto take = [&](ArticleHeading& heading) {
+        res.push_back(std::move(heading));
+        return res.size() < limit;
+    };
+    bool ordered = walkLeafPages(bstr, reader, prefix, [&](auto& heading, auto const& headingText) {
+        int headingOrder = order(headingText);
+        return headingOrder < 0 || (headingOrder == 0 && take(heading));
+    });
+    if (!ordered) {
+        res.clear();
+        scanLeafPages(bstr, reader, [&](auto& heading, auto const& headingText) {
+            return order(headingText) != 0 || take(heading);
+        });
+    }
     return res;
 }
 
@@ -33,27 +236,181 @@ LSDDictionary::LSDDictionary(common::IBitStream *bitstream)
     _overlayReader.reset(new LSDOverlayReader(_bstr, _reader.get()));
 }
 
-std::vector<ArticleHeading> LSDDictionary::readHeadings() const {
-    std::vector<ArticleHeading> headings;
-    for (size_t i = 0; i < _reader->pagesCount(); ++i) {
-        auto page = collectHeadingFromPage(*_bstr, *_reader, i);
-        copy(begin(page), end(page), back_inserter(headings));
+// Leaf pages start with an empty prefix and decode independently, so the
+// workers take batches of pages, each with its own reader over the mapping.
+template <class Headings>
+Headings collectHeadingsInParallel(std::span<const uint8_t> mapped, DictionaryReader& reader, unsigned threads) {
+    unsigned pagesCount = reader.pagesCount();
+    unsigned batchSize = std::clamp(pagesCount / (threads * 8), 1u, 64u);
+    std::vector<Headings> pages(pagesCount);
+    std::atomic<unsigned> nextBatch = 0;
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+    reader.decoder(); // loads the decoder tables before they are shared
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            try {
+                common::MemoryBitReader bstr(mapped);
+                for (;;) {
+                    unsigned first = batchSize * nextBatch++;
+                    if (first >= pagesCount)
+                        break;
+                    unsigned last = std::min(first + batchSize, pagesCount);
+                    for (unsigned page = first; page < last; ++page) {
+                        collectHeadingFromPage(bstr, reader, page, pages[page]);
+                    }
+                }
+            } catch (...) {
+                errors[i] = std::current_exception();
+                nextBatch = pagesCount;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    Headings headings;
+    for (auto& page : pages) {
+        appendHeadings(headings, page);
+        page = {};
+    }
+    return headings;
+}
+
+template <class Headings>
+Headings collectHeadings(common::IBitStream& stream, DictionaryReader& reader, unsigned threads) {
+    Headings headings;
+    auto collect = [&](auto& bstr) {
+        for (size_t i = 0; i < reader.pagesCount(); ++i) {
+            collectHeadingFromPage(bstr, reader, i, headings);
+        }
+    };
+    auto mapped = stream.span();
+    if (mapped.empty()) {
+        collect(stream);
+    } else if (threads > 1 && reader.pagesCount() > 1) {
+        headings = collectHeadingsInParallel<Headings>(mapped, reader, threads);
+    } else {
+        common::MemoryBitReader bstr(mapped);
+        collect(bstr);
     }
     return headings;
 }
 
+std::unique_lock<std::mutex> LSDDictionary::lockStream() const {
+    if (_bstr->span().empty())
+        return std::unique_lock(_streamMutex);
+    return {};
+}
+
+std::vector<ArticleHeading> LSDDictionary::readHeadings(unsigned threads) const {
+    auto lock = lockStream();
+    return collectHeadings<std::vector<ArticleHeading>>(*_bstr, *_reader, threads);
+}
+
+HeadingStore LSDDictionary::readHeadingStore(unsigned threads) const {
+    auto lock = lockStream();
+    return collectHeadings<HeadingStore>(*_bstr, *_reader, threads);
+}
+
+HeadingCursor LSDDictionary::headingCursor() const {
+    return HeadingCursor(_reader.get(), _bstr);
+}
+
+std::optional<HeadingLookup> LSDDictionary::find(std::u16string_view heading) const {
+    std::optional<ArticleHeading> found;
+    auto mapped = _bstr->span();
+    if (_index) {
+        found = _index->find(heading);
+    } else if (mapped.empty()) {
+        std::lock_guard lock(_streamMutex);
+        found = findHeading(*_bstr, *_reader, heading);
+    } else {
+        common::MemoryBitReader bstr(mapped);
+        found = findHeading(bstr, *_reader, heading);
+    }
+    if (!found)
+        return {};
+    HeadingLookup res{std::move(*found), {}};
+    readArticle(res.heading.articleReference(), res.article);
+    return res;
+}
+
+std::vector<ArticleHeading> LSDDictionary::prefixSearch(std::u16string_view prefix, size_t limit) const {
+    if (_index)
+        return _index->prefixSearch(prefix, limit);
+    auto mapped = _bstr->span();
+    if (mapped.empty()) {
+        std::lock_guard lock(_streamMutex);
+        return searchPrefix(*_bstr, *_reader, prefix, limit);
+    }
+    common::MemoryBitReader bstr(mapped);
+    return searchPrefix(bstr, *_reader, prefix, limit);
+}
+
+void LSDDictionary::openIndex(std::filesystem::path path) {
+    _index.reset();
+    try {
+        _index = std::make_unique<HeadingIndex>(path, header());
+        return;
+    } catch (std::exception&) {
+        // missing or stale, written anew below
+    }
+    HeadingIndex::write(*this, path);
+    _index = std::make_unique<HeadingIndex>(path, header());
+}
+
 std::u16string LSDDictionary::readArticle(unsigned reference) const {
-    return _reader->decodeArticle(*_bstr, reference);
+    std::u16string article;
+    readArticle(reference, article);
+    return article;
+}
+
+void LSDDictionary::readArticle(unsigned reference, std::u16string& article) const {
+    auto lock = lockStream();
+    readArticle(*_bstr, reference, article);
+}
+
+void LSDDictionary::readArticle(common::IBitStream& bstr, unsigned reference, std::u16string& article) const {
+    if (_articleCache && _articleCache->get(reference, article))
+        return;
+    _reader->decodeArticle(bstr, reference, article);
+    if (_articleCache) {
+        _articleCache->put(reference, article);
+    }
+}
+
+void LSDDictionary::setArticleCacheBudget(size_t budget) {
+    _articleCache.reset(budget ? new ArticleCache(budget) : nullptr);
+}
+
+ArticleCacheStats LSDDictionary::articleCacheStats() const {
+    return _articleCache ? _articleCache->stats() : ArticleCacheStats();
+}
+
+std::span<const uint8_t> LSDDictionary::span() const {
+    return _bstr->span();
 }
 
 std::vector<OverlayHeading> LSDDictionary::readOverlayHeadings() const {
+    std::lock_guard lock(_streamMutex);
     return _overlayReader->readHeadings();
 }
 
 std::vector<uint8_t> LSDDictionary::readOverlayEntry(OverlayHeading const& heading) const {
+    auto lock = lockStream();
     return _overlayReader->readEntry(heading);
 }
 
+std::optional<OverlayRawEntry> LSDDictionary::readOverlayRawEntry(OverlayHeading const& heading) const {
+    auto lock = lockStream();
+    return _overlayReader->readRawEntry(heading);
+}
+
 bool LSDDictionary::supported() const {
     return _reader->supported();
 }
@@ -63,6 +420,7 @@ std::u16string LSDDictionary::name() const {
 }
 
 std::u16string LSDDictionary::annotation() const {
+    auto lock = lockStream();
     return _reader->annotation();
 }
 
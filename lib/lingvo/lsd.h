@@ -1,10 +1,15 @@
 #pragma once
 
 #include "common/BitStream.h"
+#include "ArticleCache.h"
 #include "ArticleHeading.h"
+#include <filesystem>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <mutex>
 
 namespace lingvo {
 
@@ -35,22 +40,95 @@ struct OverlayHeading {
     uint32_t streamSize;
 };
 
+struct OverlayRawEntry {
+    std::vector<uint8_t> deflated; // the deflate data without the zlib wrapper
+    uint32_t crc32;
+    uint32_t inflatedSize;
+};
+
+struct HeadingLookup {
+    ArticleHeading heading; // its articleReference() is the article below
+    std::u16string article;
+};
+
 class LSDOverlayReader;
 class DictionaryReader;
+class HeadingIndex;
+
+// Reads the headings one leaf page at a time, so that only the headings
+// of the current page are held in memory.
+class HeadingCursor {
+    DictionaryReader* _reader;
+    common::IBitStream* _bstr;
+    unsigned _page = 0;
+    std::vector<ArticleHeading> _headings;
+    size_t _pos = 0;
+    bool loadPage();
+public:
+    HeadingCursor(DictionaryReader* reader, common::IBitStream* bstr);
+    // the next heading in page order or nullptr after the last one,
+    // valid until the following call
+    ArticleHeading* next();
+};
+
+// Over a memory-mapped file (see span()) any number of threads can call the
+// const members at once, each call decodes through a cursor of its own.
+// Otherwise the calls take turns on the one stream. Neither covers a
+// HeadingCursor, and openIndex and setArticleCacheBudget have to be called
+// before the dictionary is shared.
 class LSDDictionary {
     common::IBitStream* _bstr;
     std::unique_ptr<DictionaryReader> _reader;
     std::unique_ptr<LSDOverlayReader> _overlayReader;
+    std::unique_ptr<HeadingIndex> _index;
+    std::unique_ptr<ArticleCache> _articleCache;
+    mutable std::mutex _streamMutex;
+    // held by the calls that have to seek the stream, calls over a
+    // memory-mapped dictionary read through cursors of their own instead
+    std::unique_lock<std::mutex> lockStream() const;
 public:
     LSDDictionary(common::IBitStream* bitstream);
     std::u16string name() const;
     std::u16string annotation() const;
     std::vector<unsigned char> const& icon() const;
     LSDHeader const& header() const;
-    std::vector<ArticleHeading> readHeadings() const;
+    // with threads > 1 the leaf pages of a memory-mapped dictionary
+    // are decoded concurrently
+    std::vector<ArticleHeading> readHeadings(unsigned threads = 1) const;
+    // the same in a compact store, without an allocation per heading
+    HeadingStore readHeadingStore(unsigned threads = 1) const;
+    HeadingCursor headingCursor() const;
+    // Descends the heading B-tree from the root node page and decodes only
+    // the leaf pages the heading can be on. An exact match is preferred over
+    // one that differs in case or accents, nothing is returned if neither is
+    // found. Should the dictionary turn out not to be sorted the way
+    // compareHeadings sorts, every leaf page is searched instead.
+    std::optional<HeadingLookup> find(std::u16string_view heading) const;
+    // Up to limit headings that start with the prefix (regardless of case and
+    // accents), in page order. Decodes the node pages on the way to the first
+    // of them and then follows the leaf pages through their next links, with
+    // the same fallback as find().
+    std::vector<ArticleHeading> prefixSearch(std::u16string_view prefix, size_t limit) const;
+    // Serves find() and prefixSearch() from the sidecar index at path (see
+    // HeadingIndex), which is written first if it is missing or belongs to
+    // another version of the dictionary.
+    void openIndex(std::filesystem::path path);
     std::u16string readArticle(unsigned reference) const;
+    void readArticle(unsigned reference, std::u16string& article) const;
+    // decodes through another stream over the same file, so that several
+    // threads can read articles at once
+    void readArticle(common::IBitStream& bstr, unsigned reference, std::u16string& article) const;
+    // Keeps up to budget bytes of the articles read above, 0 (the default)
+    // turns the cache off. Set it before the dictionary is shared.
+    void setArticleCacheBudget(size_t budget);
+    ArticleCacheStats articleCacheStats() const;
+    // the whole file if it is mapped into memory, empty otherwise
+    std::span<const uint8_t> span() const;
     std::vector<OverlayHeading> readOverlayHeadings() const;
     std::vector<uint8_t> readOverlayEntry(OverlayHeading const& heading) const;
+    // empty if the entry can't be copied into a zip as is, readOverlayEntry
+    // inflates it then
+    std::optional<OverlayRawEntry> readOverlayRawEntry(OverlayHeading const& heading) const;
     bool supported() const;
     ~LSDDictionary();
 };
@@ -68,16 +68,4 @@ std::vector<char32_t> readSymbols(common::IBitStream* bstr) {
     return res;
 }
 
-bool readReference(common::IBitStream& bstr, unsigned& reference, unsigned huffmanNumber) {
-    int code = bstr.read(2);
-    if (code == 3) {
-        reference = bstr.read(32);
-        return true;
-    }
-    int bitlen = BitLength(huffmanNumber);
-    assert(bitlen >= 2);
-    reference = (code << (bitlen - 2)) | bstr.read(bitlen - 2);
-    return true;
-}
-
 }
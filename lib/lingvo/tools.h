@@ -1,8 +1,11 @@
 #pragma once
 
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include "common/CommonTools.h"
+#include "LenTable.h"
 #include <boost/lexical_cast.hpp>
+#include <assert.h>
 #include <stdint.h>
 #include <string>
 #include <ostream>
@@ -12,17 +15,38 @@
 
 namespace lingvo {
 
-class LenTable;
-
 unsigned UpperPrimeNumber(unsigned count);
 unsigned BitLength(unsigned num);
 std::u16string readUnicodeString(common::IBitStream* bstr, int len, bool bigEndian);
 std::vector<char32_t> readSymbols(common::IBitStream* bstr);
-bool readReference(common::IBitStream& bstr, unsigned& reference, unsigned huffmanNumber);
 uint16_t reverse16(uint16_t n);
 uint32_t reverse32(uint32_t n);
 int majorVersion(unsigned dictVersion);
 int minorVersion(unsigned dictVersion);
 int revisionVersion(unsigned dictVersion);
 
+template <common::BitReader Reader>
+bool readReference(Reader& bstr, unsigned& reference, unsigned huffmanNumber) {
+    int code = bstr.read(2);
+    if (code == 3) {
+        reference = bstr.read(32);
+        return true;
+    }
+    int bitlen = BitLength(huffmanNumber);
+    assert(bitlen >= 2);
+    reference = (code << (bitlen - 2)) | bstr.read(bitlen - 2);
+    return true;
+}
+
+template <common::BitReader Reader>
+void decodeHeading(Reader& bstr,
+                   LenTable const& ltHeadings,
+                   SymbolRunTable const& headingRuns,
+                   std::vector<char32_t> const& headingSymbols,
+                   unsigned len,
+                   std::u16string& res)
+{
+    headingRuns.Decode(bstr, ltHeadings, headingSymbols, len, res);
+}
+
 }
@@ -2,10 +2,14 @@
 #include "lingvo/DictionaryReader.h"
 #include "lingvo/LenTable.h"
 #include "common/BitStream.h"
+#include "common/BitReader.h"
 #include "lingvo/ArticleHeading.h"
 #include "lingvo/CachePage.h"
+#include "lingvo/HeadingIndex.h"
+#include "lingvo/LookupServer.h"
 #include "lingvo/WriteDsl.h"
 #include "common/ZipWriter.h"
+#include "minizip/unzip.h"
 #include "common/DslWriter.h"
 #include "lingvo/tools.h"
 #include "test-utils.h"
@@ -14,10 +18,18 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include <boost/interprocess/streams/bufferstream.hpp>
+#include <zlib.h>
 #include <tuple>
 #include <algorithm>
+#include <set>
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <numeric>
+#include <map>
+#include <functional>
 
 using namespace lingvo;
 using namespace common;
@@ -76,6 +88,48 @@ TEST(Tests, bitStreamTest) {
     ASSERT_EQ(2, bstr.tell());
 }
 
+TEST(Tests, bitStreamBufferBoundariesTest) {
+    std::vector<uint8_t> buf(50000);
+    uint32_t seed = 1;
+    for (auto& byte : buf) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 16;
+    }
+    auto bitAt = [&](unsigned pos) {
+        return (buf[pos / 8] >> (7 - pos % 8)) & 1;
+    };
+    InMemoryStream ras(buf.data(), buf.size());
+    BitStreamAdapter bstr(&ras);
+    unsigned pos = 0;
+    for (unsigned i = 0; pos + 64 < buf.size() * 8; ++i) {
+        unsigned len = i % 33;
+        unsigned expected = 0;
+        for (unsigned j = 0; j < len; ++j) {
+            expected = (expected << 1) | bitAt(pos++);
+        }
+        ASSERT_EQ(expected, bstr.read(len));
+        ASSERT_EQ((pos + 7) / 8, bstr.tell());
+        if (i % 97 == 0) {
+            bstr.toNearestByte();
+            pos = (pos + 7) / 8 * 8;
+            uint8_t bytes[3];
+            ASSERT_EQ(3, bstr.readSome(bytes, 3));
+            ASSERT_EQ(buf[pos / 8], bytes[0]);
+            ASSERT_EQ(buf[pos / 8 + 2], bytes[2]);
+            pos += 24;
+        }
+        if (i % 1013 == 0) {
+            pos = (pos / 8 - std::min(pos / 8, 300u)) * 8;
+            bstr.seek(pos / 8);
+        }
+    }
+    std::vector<uint8_t> tail(20000);
+    bstr.seek(1);
+    ASSERT_EQ(tail.size(), bstr.readSome(tail.data(), tail.size()));
+    ASSERT_TRUE(std::equal(begin(tail), end(tail), begin(buf) + 1));
+    ASSERT_EQ(tail.size() + 1, bstr.tell());
+}
+
 TEST(Tests, decoderTest) {
     std::ifstream f(testPath("simple_testdict1/test.lsd"), std::ios::binary);
     ASSERT_TRUE(f.is_open());
@@ -145,6 +199,265 @@ TEST(Tests, userLsdHeadingsTest) {
     }
 }
 
+TEST(Tests, findHeadingTest) {
+    for (auto name : {"headingsTestDict1_x5.lsd", "unsorted_testdict.lsd", "variants_testdict.lsd"}) {
+        auto path = testPath(fmt::format("simple_testdict1/{}", name).c_str());
+        FileStream fileRas(path);
+        BitStreamAdapter fileBstr(&fileRas);
+        LSDDictionary fileReader(&fileBstr);
+        MappedFileStream mappedRas(path);
+        BitStreamAdapter mappedBstr(&mappedRas);
+        LSDDictionary mappedReader(&mappedBstr);
+
+        for (auto& heading : fileReader.readHeadings()) {
+            for (auto reader : {&fileReader, &mappedReader}) {
+                auto found = reader->find(heading.text());
+                ASSERT_TRUE(found);
+                ASSERT_EQ(heading.text(), found->heading.text());
+                ASSERT_EQ(heading.articleReference(), found->heading.articleReference());
+                ASSERT_EQ(fileReader.readArticle(heading.articleReference()), found->article);
+            }
+        }
+        ASSERT_FALSE(mappedReader.find(u"Abcd"));
+        ASSERT_FALSE(mappedReader.find(u""));
+    }
+
+    MappedFileStream ras(testPath("simple_testdict1/headingsTestDict1_x5.lsd"));
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    auto found = reader.find(u"ABCDE");
+    ASSERT_TRUE(found);
+    ASSERT_EQ(u"Abcde", found->heading.text());
+    ASSERT_EQ(u"Abcde", found->heading.dslText());
+}
+
+TEST(Tests, prefixSearchTest) {
+    MappedFileStream ras(testPath("simple_testdict1/headingsTestDict1_x5.lsd"));
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    auto texts = [&](std::u16string_view prefix, size_t limit) {
+        std::vector<std::u16string> res;
+        for (auto& heading : reader.prefixSearch(prefix, limit)) {
+            res.push_back(heading.text());
+        }
+        return res;
+    };
+    using v = std::vector<std::u16string>;
+    ASSERT_EQ((v{u"Abcdefg", u"Abcdefg123", u"Abcdefg123ZzzzZ"}), texts(u"abcdefg", 10));
+    ASSERT_EQ((v{u"Abcdefg", u"Abcdefg123"}), texts(u"Abcdefg", 2));
+    ASSERT_EQ((v{u"Zzxx"}), texts(u"ZZ", 10));
+    ASSERT_EQ(v{}, texts(u"b", 10));
+    ASSERT_EQ(v{}, texts(u"Abc", 0));
+    ASSERT_EQ(7, texts(u"", 100).size());
+}
+
+TEST(Tests, headingIndexTest) {
+    auto indexPath = std::filesystem::path("headingIndexTest.lsd.idx");
+    std::filesystem::remove(indexPath);
+    for (auto name : {"headingsTestDict1_x5.lsd", "unsorted_testdict.lsd", "variants_testdict.lsd"}) {
+        auto path = testPath(fmt::format("simple_testdict1/{}", name).c_str());
+        MappedFileStream ras(path);
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr);
+        MappedFileStream indexedRas(path);
+        BitStreamAdapter indexedBstr(&indexedRas);
+        LSDDictionary indexed(&indexedBstr);
+        // the index left by the previous dictionary is stale and gets replaced
+        indexed.openIndex(indexPath);
+        ASSERT_EQ(reader.header().entriesCount, HeadingIndex(indexPath, reader.header()).size());
+
+        auto headings = reader.readHeadings();
+        std::stable_sort(begin(headings), end(headings), [](auto& a, auto& b) {
+            return compareHeadings(a.text(), b.text()) < 0;
+        });
+        for (auto& heading : headings) {
+            auto found = indexed.find(heading.text());
+            ASSERT_TRUE(found);
+            ASSERT_EQ(heading.dslText(), found->heading.dslText());
+            ASSERT_EQ(heading.articleReference(), found->heading.articleReference());
+            ASSERT_EQ(reader.readArticle(heading.articleReference()), found->article);
+            auto text = heading.text();
+            for (size_t len = 0; len <= text.size(); ++len) {
+                auto prefix = std::u16string_view(text).substr(0, len);
+                std::vector<ArticleHeading> expected;
+                for (auto& other : headings) {
+                    if (expected.size() < 3 && compareHeadings(other.text().substr(0, len), prefix) == 0) {
+                        expected.push_back(other);
+                    }
+                }
+                auto actual = indexed.prefixSearch(prefix, 3);
+                ASSERT_EQ(expected.size(), actual.size());
+                for (size_t i = 0; i < expected.size(); ++i) {
+                    ASSERT_EQ(expected[i].dslText(), actual[i].dslText());
+                }
+            }
+        }
+        ASSERT_FALSE(indexed.find(u"Abcd"));
+    }
+
+    MappedFileStream ras(testPath("simple_testdict1/test.lsd"));
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    ASSERT_THROW(HeadingIndex(indexPath, reader.header()), std::runtime_error);
+    std::filesystem::remove(indexPath);
+}
+
+TEST(Tests, articleCacheTest) {
+    ArticleCache cache(1000);
+    std::u16string article;
+    ASSERT_FALSE(cache.get(1, article));
+    cache.put(1, std::u16string(100, u'a'));
+    cache.put(2, std::u16string(100, u'b'));
+    ASSERT_TRUE(cache.get(1, article));
+    ASSERT_EQ(std::u16string(100, u'a'), article);
+    // 1 is now more recently used than 2, which goes first
+    cache.put(3, std::u16string(300, u'c'));
+    cache.put(4, std::u16string(1000, u'd'));
+    ASSERT_FALSE(cache.get(2, article));
+    ASSERT_FALSE(cache.get(4, article));
+    ASSERT_TRUE(cache.get(1, article));
+    ASSERT_TRUE(cache.get(3, article));
+    auto stats = cache.stats();
+    ASSERT_EQ(3, stats.hits);
+    ASSERT_EQ(3, stats.misses);
+    ASSERT_EQ(2, stats.articles);
+    ASSERT_LE(stats.bytes, 1000);
+
+    MappedFileStream ras(testPath("simple_testdict1/variants_testdict.lsd"));
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    auto headings = reader.readHeadings();
+    std::vector<std::u16string> articles;
+    for (auto& heading : headings) {
+        articles.push_back(reader.readArticle(heading.articleReference()));
+    }
+    reader.setArticleCacheBudget(1 << 20);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < headings.size(); ++i) {
+            ASSERT_EQ(articles[i], reader.readArticle(headings[i].articleReference()));
+        }
+    }
+    std::set<unsigned> references;
+    for (auto& heading : headings) {
+        references.insert(heading.articleReference());
+    }
+    stats = reader.articleCacheStats();
+    ASSERT_EQ(references.size(), stats.misses);
+    ASSERT_EQ(2 * headings.size() - references.size(), stats.hits);
+}
+
+TEST(Tests, concurrentReadersTest) {
+    for (auto name : {"variants_testdict.lsd", "overlay_x5.lsd"}) {
+        auto path = testPath(fmt::format("simple_testdict1/{}", name).c_str());
+        MappedFileStream serialRas(path);
+        BitStreamAdapter serialBstr(&serialRas);
+        LSDDictionary serial(&serialBstr);
+        auto headings = serial.readHeadings();
+        std::vector<std::u16string> articles;
+        for (auto& heading : headings) {
+            articles.push_back(serial.readArticle(heading.articleReference()));
+        }
+        auto annotation = serial.annotation();
+
+        // shared from the start, so the threads also race to load the decoder
+        MappedFileStream ras(path);
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr);
+        reader.setArticleCacheBudget(1 << 10);
+        std::vector<std::thread> threads;
+        std::atomic<int> mismatches = 0;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&, t] {
+                for (int pass = 0; pass < 20; ++pass) {
+                    for (size_t i = 0; i < headings.size(); ++i) {
+                        auto& heading = headings[(i + t) % headings.size()];
+                        auto& article = articles[(i + t) % headings.size()];
+                        auto found = reader.find(heading.text());
+                        if (!found || found->article != article ||
+                            reader.readArticle(heading.articleReference()) != article ||
+                            reader.prefixSearch(heading.text(), 1).size() != 1) {
+                            mismatches++;
+                        }
+                    }
+                    if (reader.annotation() != annotation) {
+                        mismatches++;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQ(0, mismatches);
+    }
+}
+
+TEST(Tests, lookupServerTest) {
+    TestLog log;
+    LookupServer server(4, 1 << 20);
+    server.addDictionary(testPath("simple_testdict1/headingsTestDict1_x5.lsd"), false, log);
+    server.addDictionary(testPath("simple_testdict1/test.lsd"), false, log);
+    ASSERT_THROW(server.addDictionary(testPath("simple_testdict1/test.lsd"), false, log), std::runtime_error);
+    ASSERT_THROW(server.addDictionary(testPath("simple_testdict1/test.dsl"), false, log), std::runtime_error);
+
+    MappedFileStream ras(testPath("simple_testdict1/headingsTestDict1_x5.lsd"));
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    auto article = toUtf8(reader.find(u"Abcde")->article);
+    ASSERT_EQ("{\"id\": 1, \"results\": [{\"dict\": \"headingsTestDict1_x5\", \"heading\": \"Abcde\", "
+              "\"article\": \"" + article + "\"}]}",
+              server.handle(R"({"id": 1, "op": "find", "heading": "abcde"})"));
+    ASSERT_EQ(R"({"id": "a", "results": [{"dict": "headingsTestDict1_x5", "heading": "Abcdefg"}, )"
+              R"({"dict": "headingsTestDict1_x5", "heading": "Abcdefg123"}]})",
+              server.handle(R"({"id": "a", "op": "prefix", "prefix": "\u0041bcdefg", "limit": 2})"));
+    ASSERT_EQ(R"({"id": 2, "results": [{"dict": "test", "heading": "A"}]})",
+              server.handle(R"({"id": 2, "op": "prefix", "prefix": "a", "dict": "test"})"));
+    ASSERT_EQ(R"({"id": 3, "results": []})", server.handle(R"({"id": 3, "op": "find", "heading": "none"})"));
+    ASSERT_EQ(R"({"id": 4, "error": "unknown dictionary: other"})",
+              server.handle(R"({"id": 4, "op": "list", "dict": "other"})"));
+    ASSERT_EQ(R"({"id": 5, "error": "\"heading\" has to be a string"})",
+              server.handle(R"({"id": 5, "op": "find"})"));
+    ASSERT_EQ(R"({"id": null, "error": "malformed request at offset 8"})", server.handle(R"({"id": 1)"));
+    for (auto id : {"1-2", "+1", "1.2.3", "1e", "01", ".5", "1."}) {
+        ASSERT_EQ(R"({"id": null, "error": "malformed request at offset 7"})",
+                  server.handle(fmt::format(R"({{"id": {}, "op": "list"}})", id)));
+    }
+    ASSERT_EQ(R"({"id": -1.5e+2, "results": []})",
+              server.handle(R"({"id": -1.5e+2, "op": "find", "heading": "none"})"));
+    ASSERT_EQ(R"({"id": 6, "error": "\"limit\" has to be a number from 0 to 100000"})",
+              server.handle(R"({"id": 6, "op": "prefix", "prefix": "a", "limit": 1e300})"));
+
+    std::stringstream in, out;
+    for (int i = 0; i < 100; ++i) {
+        in << fmt::format(R"({{"id": {}, "op": "find", "heading": "{}"}})", i, i % 2 ? "Zzxx" : "B") << "\r\n\n";
+    }
+    server.serve(in, out);
+    std::set<std::string> responses;
+    std::string line;
+    while (std::getline(out, line)) {
+        responses.insert(line);
+    }
+    ASSERT_EQ(100, responses.size());
+    for (int i = 0; i < 100; ++i) {
+        auto request = fmt::format(R"({{"id": {}, "op": "find", "heading": "{}"}})", i, i % 2 ? "Zzxx" : "B");
+        ASSERT_EQ(1, responses.count(server.handle(request)));
+    }
+
+    // a directory in place of the index can be neither mapped nor replaced,
+    // the dictionary is served without it
+    auto dir = std::filesystem::path("lookupServerTest");
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "test.lsd.idx" / "busy");
+    std::filesystem::copy_file(testPath("simple_testdict1/test.lsd"), dir / "test.lsd");
+    LookupServer unindexed(1, 1 << 20);
+    unindexed.addDictionary(dir / "test.lsd", true, log);
+    ASSERT_EQ(server.handle(R"({"id": 1, "op": "find", "heading": "A", "dict": "test"})"),
+              unindexed.handle(R"({"id": 1, "op": "find", "heading": "A"})"));
+    ASSERT_EQ(3, std::distance(std::filesystem::directory_iterator(dir), {}) +
+                 std::distance(std::filesystem::directory_iterator(dir / "test.lsd.idx"), {}));
+    std::filesystem::remove_all(dir);
+}
+
 TEST(Tests, overlayTest) {
     for (auto path : {testPath("simple_testdict1/overlay_12.lsd"),
                       testPath("simple_testdict1/overlay_x3.lsd"),
@@ -167,6 +480,600 @@ TEST(Tests, overlayTest) {
     }
 }
 
+TEST(Tests, overlayRawEntryTest) {
+    for (auto path : {testPath("simple_testdict1/overlay_12.lsd"),
+                      testPath("simple_testdict1/overlay_x3.lsd"),
+                      testPath("simple_testdict1/overlay_x5.lsd")}) {
+        MappedFileStream ras(path);
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr);
+        for (auto& heading : reader.readOverlayHeadings()) {
+            auto entry = reader.readOverlayEntry(heading);
+            auto raw = reader.readOverlayRawEntry(heading);
+            ASSERT_TRUE(raw);
+            ASSERT_EQ(entry.size(), raw->inflatedSize);
+            ASSERT_EQ(crc32(0, entry.data(), entry.size()), raw->crc32);
+
+            std::vector<uint8_t> inflated(raw->inflatedSize);
+            z_stream strm{};
+            ASSERT_EQ(Z_OK, inflateInit2(&strm, -MAX_WBITS));
+            strm.next_in = raw->deflated.data();
+            strm.avail_in = raw->deflated.size();
+            strm.next_out = inflated.data();
+            strm.avail_out = inflated.size();
+            ASSERT_EQ(Z_STREAM_END, inflate(&strm, Z_FINISH));
+            inflateEnd(&strm);
+            ASSERT_EQ(entry, inflated);
+        }
+    }
+}
+
+TEST(Tests, mappedFileStreamTest) {
+    auto path = testPath("simple_testdict1/overlay_x5.lsd");
+    auto buf = read_all_bytes(path);
+    MappedFileStream ras(path);
+    ASSERT_EQ(buf.size(), ras.span().size());
+    ASSERT_TRUE(std::equal(begin(buf), end(buf), ras.span().begin()));
+    ras.seek(10);
+    uint8_t bytes[4];
+    ASSERT_EQ(4, ras.readSome(bytes, 4));
+    ASSERT_EQ(14, ras.tell());
+    ASSERT_TRUE(std::equal(bytes, bytes + 4, begin(buf) + 10));
+    ras.seek(buf.size() - 2);
+    ASSERT_EQ(2, ras.readSome(bytes, 4));
+
+    ras.seek(0);
+    BitStreamAdapter bstr(&ras);
+    LSDDictionary reader(&bstr);
+    auto headings = reader.readOverlayHeadings();
+    ASSERT_EQ(2, headings.size());
+    ASSERT_EQ(read_all_bytes(testPath("simple_testdict1/image1.bmp")), reader.readOverlayEntry(headings[0]));
+    ASSERT_EQ(read_all_bytes(testPath("simple_testdict1/image2.bmp")), reader.readOverlayEntry(headings[1]));
+}
+
+TEST(Tests, memoryReaderPastEndTest) {
+    std::vector<uint8_t> buf(100);
+    std::iota(begin(buf), end(buf), 1);
+    std::span<const uint8_t> truncated(buf.data(), 10);
+    MemoryBitReader reader(truncated, 512 * 3);
+    ASSERT_EQ(10, reader.tell());
+    reader.seek(7);
+    ASSERT_EQ(0x0809u, reader.read(16));
+    reader.seek(512 * 5);
+    ASSERT_EQ(10, reader.tell());
+    ASSERT_EQ(0u, reader.read(32));
+    uint8_t bytes[16];
+    ASSERT_EQ(0, reader.readSome(bytes, sizeof(bytes)));
+    XoringMemoryBitReader xoring(truncated);
+    xoring.seek(-1);
+    ASSERT_EQ(0, xoring.readSome(bytes, sizeof(bytes)));
+}
+
+TEST(Tests, xoringAdapterAttachTest) {
+    std::vector<uint8_t> buf(300);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = i * 37 + 11;
+    }
+    InMemoryStream first(buf.data(), buf.size());
+    InMemoryStream second(buf.data(), buf.size());
+    XoringStreamAdapter adapter(&first);
+    adapter.read(13);
+    for (unsigned offset : {0u, 5u, 200u}) {
+        second.seek(offset);
+        adapter.attach(&second);
+        XoringMemoryBitReader expected(buf, offset);
+        for (int i = 0; i < 20; ++i) {
+            ASSERT_EQ(expected.read(7), adapter.read(7));
+        }
+    }
+}
+
+void writeMultiPageDictionary(std::filesystem::path const& path,
+                              std::vector<std::u16string> const& headings,
+                              unsigned headingsPerLeaf,
+                              unsigned childrenPerNode);
+std::vector<std::u16string> multiPageHeadings();
+
+TEST(Tests, memoryReaderMatchesStreamTest) {
+    std::vector<std::filesystem::path> paths;
+    for (auto name : {"test.lsd", "testext.lsd", "unsorted_testdict.lsd", "variants_testdict.lsd",
+                      "headingsTestDict1_12.lsd", "headingsTestDict1_x3.lsd", "overlay_x5.lsd"}) {
+        paths.push_back(testPath(fmt::format("simple_testdict1/{}", name).c_str()));
+    }
+    // the only one with more than a page, for the parallel decoding and
+    // the cursor moving from page to page
+    paths.push_back("multiPageStream.lsd");
+    writeMultiPageDictionary(paths.back(), multiPageHeadings(), 8, 4);
+    for (auto& path : paths) {
+        FileStream fileRas(path);
+        BitStreamAdapter fileBstr(&fileRas);
+        LSDDictionary fileReader(&fileBstr);
+        MappedFileStream mappedRas(path);
+        BitStreamAdapter mappedBstr(&mappedRas);
+        LSDDictionary mappedReader(&mappedBstr);
+
+        auto fileHeadings = fileReader.readHeadings();
+        auto mappedHeadings = mappedReader.readHeadings();
+        ASSERT_EQ(fileHeadings.size(), mappedHeadings.size());
+        auto parallelHeadings = mappedReader.readHeadings(4);
+        ASSERT_EQ(fileHeadings.size(), parallelHeadings.size());
+        auto fileStore = fileReader.readHeadingStore();
+        auto parallelStore = mappedReader.readHeadingStore(4);
+        ASSERT_EQ(fileHeadings.size(), fileStore.size());
+        ASSERT_EQ(fileHeadings.size(), parallelStore.size());
+        auto fileCursor = fileReader.headingCursor();
+        auto mappedCursor = mappedReader.headingCursor();
+        for (auto& heading : fileHeadings) {
+            ASSERT_EQ(heading.dslText(), fileCursor.next()->dslText());
+            ASSERT_EQ(heading.articleReference(), mappedCursor.next()->articleReference());
+        }
+        ASSERT_EQ(nullptr, fileCursor.next());
+        ASSERT_EQ(nullptr, mappedCursor.next());
+        std::u16string reused;
+        for (size_t i = 0; i < fileHeadings.size(); ++i) {
+            ASSERT_EQ(fileHeadings[i].dslText(), mappedHeadings[i].dslText());
+            ASSERT_EQ(fileHeadings[i].dslText(), parallelHeadings[i].dslText());
+            ASSERT_EQ(fileHeadings[i].dslText(), fileStore.dslText(i));
+            ASSERT_EQ(fileHeadings[i].dslText(), parallelStore.dslText(i));
+            ASSERT_EQ(fileHeadings[i].text(), parallelStore.heading(i).text());
+            ASSERT_EQ(fileHeadings[i].articleReference(), parallelStore.articleReference(i));
+            auto reference = fileHeadings[i].articleReference();
+            ASSERT_EQ(reference, mappedHeadings[i].articleReference());
+            auto article = fileReader.readArticle(reference);
+            ASSERT_EQ(article, mappedReader.readArticle(reference));
+            mappedReader.readArticle(reference, reused);
+            ASSERT_EQ(article, reused);
+        }
+        auto tell = mappedBstr.tell();
+        auto pastEnd = static_cast<unsigned>(std::filesystem::file_size(path));
+        ASSERT_THROW(mappedReader.readArticle(pastEnd, reused), std::runtime_error);
+        ASSERT_EQ(tell, mappedBstr.tell());
+    }
+    std::filesystem::remove(paths.back());
+}
+
+TEST(Tests, xoringMemoryReaderTest) {
+    std::vector<uint8_t> buf(3000);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = i * 7 + (i >> 3);
+    }
+    InMemoryStream ras(buf.data(), buf.size());
+    BitStreamAdapter inner(&ras);
+    inner.seek(100);
+    XoringStreamAdapter xoring(&inner);
+    XoringMemoryBitReader reader(buf, 100);
+    for (unsigned i = 0; i < 2000; ++i) {
+        ASSERT_EQ(xoring.read(i % 33), reader.read(i % 33));
+    }
+    ASSERT_EQ(xoring.tell(), reader.tell());
+}
+
+class BitPacker {
+    std::vector<uint8_t> _bytes;
+    unsigned _bits = 0;
+public:
+    void write(unsigned value, unsigned len) {
+        while (len--) {
+            if (_bits % 8 == 0)
+                _bytes.push_back(0);
+            _bytes.back() |= ((value >> len) & 1) << (7 - _bits % 8);
+            _bits++;
+        }
+    }
+    std::vector<uint8_t>& bytes() { return _bytes; }
+};
+
+// a degenerate tree with codes from 1 to 15 bits, deeper than the root lookup table
+const unsigned degenerateTableSize = 16;
+
+void readDegenerateTable(LenTable& lenTable) {
+    const unsigned bitsPerLen = 4;
+    BitPacker table;
+    table.write(degenerateTableSize, 32);
+    table.write(bitsPerLen, 8);
+    for (unsigned sym = 0; sym < degenerateTableSize; ++sym) {
+        table.write(sym, BitLength(degenerateTableSize));
+        table.write(std::min(sym + 1, degenerateTableSize - 1), bitsPerLen);
+    }
+    InMemoryStream tableRas(table.bytes().data(), table.bytes().size());
+    BitStreamAdapter tableBstr(&tableRas);
+    lenTable.Read(tableBstr);
+}
+
+unsigned encodeSymbol(LenTable const& lenTable, unsigned sym, BitPacker& out) {
+    std::vector<int> path;
+    int nodeIdx = lenTable.symidx2nodeidx.at(sym);
+    path.push_back(lenTable.nodes.at(nodeIdx).right == -1 - static_cast<int>(sym));
+    for (;;) {
+        int parent = lenTable.nodes.at(nodeIdx).parent;
+        if (parent == -1)
+            break;
+        path.push_back(lenTable.nodes.at(parent).right == nodeIdx + 1);
+        nodeIdx = parent;
+    }
+    std::for_each(path.rbegin(), path.rend(), [&](int bit) { out.write(bit, 1); });
+    return path.size();
+}
+
+// a complete code over count symbols (a power of two) with every length equal
+void writeFlatTable(BitPacker& out, unsigned count) {
+    out.write(count, 32);
+    out.write(8, 8);
+    for (unsigned sym = 0; sym < count; ++sym) {
+        out.write(sym, BitLength(count));
+        out.write(BitLength(count) - 1, 8);
+    }
+}
+
+LenTable readFlatTable(unsigned count) {
+    BitPacker table;
+    writeFlatTable(table, count);
+    InMemoryStream ras(table.bytes().data(), table.bytes().size());
+    BitStreamAdapter bstr(&ras);
+    LenTable lenTable;
+    lenTable.Read(bstr);
+    return lenTable;
+}
+
+unsigned flatTableSize(size_t symbols) {
+    unsigned count = 2;
+    while (count < symbols) {
+        count *= 2;
+    }
+    return count;
+}
+
+void appendBytes(std::vector<uint8_t>& file, BitPacker& packer) {
+    file.insert(end(file), begin(packer.bytes()), end(packer.bytes()));
+}
+
+// Writes a user dictionary with the headings, in page order, spread over leaf
+// pages of headingsPerLeaf headings each and a B-tree of node pages with up to
+// childrenPerNode children above them. The article of a heading is "article "
+// followed by the heading.
+void writeMultiPageDictionary(std::filesystem::path const& path,
+                              std::vector<std::u16string> const& headings,
+                              unsigned headingsPerLeaf,
+                              unsigned childrenPerNode)
+{
+    std::u16string articlePrefix = u"article ";
+    std::vector<char16_t> symbols(begin(articlePrefix), end(articlePrefix));
+    for (auto& heading : headings) {
+        symbols.insert(end(symbols), begin(heading), end(heading));
+    }
+    std::sort(begin(symbols), end(symbols));
+    symbols.erase(std::unique(begin(symbols), end(symbols)), end(symbols));
+    std::map<char16_t, unsigned> symIndex;
+    for (unsigned i = 0; i < symbols.size(); ++i) {
+        symIndex[symbols[i]] = i;
+    }
+    auto symbolsCount = flatTableSize(symbols.size());
+    symbols.resize(symbolsCount, u' ');
+    const unsigned lengthsCount = 64;
+    auto ltSymbols = readFlatTable(symbolsCount);
+    auto ltLengths = readFlatTable(lengthsCount);
+    auto writeChars = [&](BitPacker& out, std::u16string_view chars) {
+        for (auto chr : chars) {
+            encodeSymbol(ltSymbols, symIndex.at(chr), out);
+        }
+    };
+    auto writeFrontCoded = [&](BitPacker& out, std::u16string& known, std::u16string const& text) {
+        auto prefixLen = std::mismatch(begin(known), end(known), begin(text), end(text)).first - begin(known);
+        EXPECT_LT(text.size(), lengthsCount);
+        encodeSymbol(ltLengths, prefixLen, out);
+        encodeSymbol(ltLengths, text.size() - prefixLen, out);
+        writeChars(out, std::u16string_view(text).substr(prefixLen));
+        known = text;
+    };
+
+    struct Page {
+        bool isLeaf;
+        unsigned first; // the first heading of a leaf, the first child of a node
+        unsigned count;
+        unsigned parent;
+    };
+    const unsigned noPage = 0xffff;
+    std::vector<Page> pages;
+    for (unsigned first = 0; first < headings.size(); first += headingsPerLeaf) {
+        pages.push_back({true, first, std::min<unsigned>(headingsPerLeaf, headings.size() - first), noPage});
+    }
+    for (unsigned level = 0, levelEnd = pages.size(); levelEnd - level > 1; levelEnd = pages.size()) {
+        for (unsigned first = level; first < levelEnd; first += childrenPerNode) {
+            unsigned count = std::min(childrenPerNode, levelEnd - first);
+            for (unsigned child = first; child < first + count; ++child) {
+                pages[child].parent = pages.size();
+            }
+            pages.push_back({false, first, count, noPage});
+        }
+        level = levelEnd;
+    }
+    std::function<unsigned(unsigned)> firstHeading = [&](unsigned page) {
+        return pages[page].isLeaf ? pages[page].first : firstHeading(pages[page].first);
+    };
+    std::function<unsigned(unsigned)> lastHeading = [&](unsigned page) {
+        auto& p = pages[page];
+        return p.isLeaf ? p.first + p.count - 1 : lastHeading(p.first + p.count - 1);
+    };
+
+    LSDHeader header{};
+    strcpy(header.magic, "LingVo");
+    header.version = 0x142001;
+    header.entriesCount = headings.size();
+    header.lastPage = pages.size() - 1;
+    std::vector<uint8_t> file(sizeof(LSDHeader));
+    file.resize(file.size() + 1 + 1 + 1 + 4 + 2 + 4 + 4 + 4);
+    auto pagesEndPos = file.size() - 8;
+
+    header.annotationOffset = file.size();
+    BitPacker annotation;
+    annotation.write(0, 16);
+    appendBytes(file, annotation);
+
+    header.dictionaryEncoderOffset = file.size();
+    BitPacker decoder;
+    decoder.write(0, 32);
+    for (int table = 0; table < 2; ++table) {
+        decoder.write(symbols.size(), 32);
+        decoder.write(16, 8);
+        for (auto chr : symbols) {
+            decoder.write(chr, 16);
+        }
+    }
+    writeFlatTable(decoder, symbolsCount);
+    writeFlatTable(decoder, symbolsCount);
+    writeFlatTable(decoder, lengthsCount);
+    writeFlatTable(decoder, lengthsCount);
+    decoder.write(4, 32);
+    decoder.write(4, 32);
+    appendBytes(file, decoder);
+
+    header.articlesOffset = file.size();
+    std::vector<unsigned> references;
+    for (auto& heading : headings) {
+        references.push_back(file.size() - header.articlesOffset);
+        BitPacker article;
+        article.write(articlePrefix.size() + heading.size(), 16);
+        writeChars(article, articlePrefix);
+        writeChars(article, heading);
+        appendBytes(file, article);
+    }
+
+    header.pagesOffset = file.size();
+    for (unsigned number = 0; number < pages.size(); ++number) {
+        auto& page = pages[number];
+        bool linked = page.isLeaf && pages.size() > 1;
+        BitPacker out;
+        out.write(page.isLeaf, 1);
+        out.write(number, 16);
+        out.write(linked && number > 0 ? number - 1 : noPage, 16);
+        out.write(page.parent, 16);
+        out.write(linked && !pages[number + 1].isLeaf ? noPage : linked ? number + 1 : noPage, 16);
+        out.write(page.count, 16);
+        out.write(0, 7); // to the next byte
+        std::u16string known;
+        if (page.isLeaf) {
+            for (unsigned i = page.first; i < page.first + page.count; ++i) {
+                writeFrontCoded(out, known, headings[i]);
+                out.write(3, 2);
+                out.write(references[i], 32);
+                out.write(0, 1);
+            }
+        } else {
+            out.write(3, 2);
+            out.write(page.first, 32);
+            // the shortest prefix of the next child that sorts after this one
+            for (unsigned child = page.first; child + 1 < page.first + page.count; ++child) {
+                auto const& last = headings[lastHeading(child)];
+                auto const& next = headings[firstHeading(child + 1)];
+                size_t len = 1;
+                while (len < next.size() && compareHeadings(last, next.substr(0, len)) >= 0) {
+                    len++;
+                }
+                writeFrontCoded(out, known, next.substr(0, len));
+            }
+        }
+        ASSERT_LE(out.bytes().size(), 512u);
+        out.bytes().resize(512);
+        appendBytes(file, out);
+    }
+
+    uint32_t pagesEnd = file.size();
+    uint32_t overlayData = -1;
+    std::memcpy(&file[pagesEndPos], &pagesEnd, 4);
+    std::memcpy(&file[pagesEndPos + 4], &overlayData, 4);
+    std::memcpy(file.data(), &header, sizeof(LSDHeader));
+    file.resize(file.size() + 4 + 16); // no overlay entries, and room to peek past the end
+
+    std::ofstream stream(path, std::ios::binary);
+    stream.write(reinterpret_cast<char const*>(file.data()), file.size());
+}
+
+// About five hundred headings in the order of compareHeadings, no two of them
+// the same regardless of case and accents, in Latin, Cyrillic and Greek.
+std::vector<std::u16string> multiPageHeadings() {
+    const char16_t* syllables[] = {
+        u"ka", u"Lo", u"mi", u"ber", u"An", u"st", u"que", u"zu",
+        u"är", u"Ét", u"öl", u"ña", u"ß",
+        u"ёж", u"Жу", u"ра", u"Ел", u"ще",
+        u"λό", u"Σο", u"φι",
+    };
+    auto less = [](std::u16string const& left, std::u16string const& right) {
+        return compareHeadings(left, right) < 0;
+    };
+    std::set<std::u16string, decltype(less)> headings(less);
+    unsigned seed = 1;
+    while (headings.size() < 500) {
+        seed = seed * 1103515245 + 12345;
+        std::u16string heading;
+        for (unsigned i = 0, count = 1 + (seed >> 8) % 4; i < count; ++i) {
+            heading += syllables[(seed >> (10 + 5 * i)) % std::size(syllables)];
+        }
+        headings.insert(heading);
+    }
+    return {begin(headings), end(headings)};
+}
+
+TEST(Tests, multiPageFindTest) {
+    auto headings = multiPageHeadings();
+    auto path = std::filesystem::path("multiPage.lsd");
+    writeMultiPageDictionary(path, headings, 8, 4);
+    FileStream fileRas(path.string());
+    BitStreamAdapter fileBstr(&fileRas);
+    LSDDictionary fileReader(&fileBstr);
+    MappedFileStream mappedRas(path.string());
+    BitStreamAdapter mappedBstr(&mappedRas);
+    LSDDictionary mappedReader(&mappedBstr);
+    // 63 leaves under three levels of node pages
+    ASSERT_EQ(63 + 16 + 4 + 1, fileReader.header().lastPage + 1);
+
+    auto read = fileReader.readHeadings();
+    ASSERT_EQ(headings.size(), read.size());
+    for (size_t i = 0; i < headings.size(); ++i) {
+        ASSERT_EQ(headings[i], read[i].text());
+    }
+    for (auto& heading : headings) {
+        for (auto reader : {&fileReader, &mappedReader}) {
+            auto found = reader->find(heading);
+            ASSERT_TRUE(found) << toUtf8(heading);
+            ASSERT_EQ(heading, found->heading.text());
+            ASSERT_EQ(u"article " + heading, found->article);
+        }
+    }
+    auto findText = [&](std::u16string_view heading) {
+        auto found = mappedReader.find(heading);
+        return found ? found->heading.text() : u"-";
+    };
+    for (auto& heading : headings) {
+        if (heading.starts_with(u"är")) {
+            ASSERT_EQ(heading, findText(u"AR" + heading.substr(2)));
+        } else if (heading.starts_with(u"ёж")) {
+            ASSERT_EQ(heading, findText(u"ЕЖ" + heading.substr(2)));
+        }
+    }
+    ASSERT_EQ(u"-", findText(u"a"));
+    ASSERT_EQ(u"-", findText(u"zzz"));
+    ASSERT_EQ(u"-", findText(headings.front().substr(0, 1)));
+
+    // sorted by code point, so the B-tree can't be descended the way
+    // compareHeadings orders the headings and every page is searched
+    std::sort(begin(headings), end(headings));
+    writeMultiPageDictionary(path, headings, 8, 4);
+    MappedFileStream unsortedRas(path.string());
+    BitStreamAdapter unsortedBstr(&unsortedRas);
+    LSDDictionary unsortedReader(&unsortedBstr);
+    for (auto& heading : headings) {
+        auto found = unsortedReader.find(heading);
+        ASSERT_TRUE(found) << toUtf8(heading);
+        ASSERT_EQ(heading, found->heading.text());
+    }
+    ASSERT_FALSE(unsortedReader.find(u"zzz"));
+    std::filesystem::remove(path);
+}
+
+TEST(Tests, multiPagePrefixSearchTest) {
+    auto headings = multiPageHeadings();
+    auto path = std::filesystem::path("multiPagePrefix.lsd");
+    for (bool sorted : {true, false}) {
+        if (!sorted) {
+            std::sort(begin(headings), end(headings));
+        }
+        writeMultiPageDictionary(path, headings, 8, 4);
+        MappedFileStream ras(path.string());
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr);
+        auto expected = [&](std::u16string_view prefix, size_t limit) {
+            std::vector<std::u16string> res;
+            for (auto& heading : headings) {
+                auto start = std::u16string_view(heading).substr(0, prefix.size());
+                if (res.size() < limit && compareHeadings(start, prefix) == 0) {
+                    res.push_back(heading);
+                }
+            }
+            return res;
+        };
+        auto texts = [&](std::u16string_view prefix, size_t limit) {
+            std::vector<std::u16string> res;
+            for (auto& heading : reader.prefixSearch(prefix, limit)) {
+                res.push_back(heading.text());
+            }
+            return res;
+        };
+        size_t longest = 0;
+        std::set<std::u16string> prefixes{u"AR", u"ЕЖ", u"ΣΟ", u"kalo", u"x"};
+        for (auto& heading : headings) {
+            for (size_t len = 1; len <= 4 && len <= heading.size(); ++len) {
+                prefixes.insert(heading.substr(0, len));
+            }
+        }
+        for (auto& prefix : prefixes) {
+            auto all = expected(prefix, -1);
+            longest = std::max(longest, all.size());
+            ASSERT_EQ(all, texts(prefix, -1)) << toUtf8(prefix);
+            ASSERT_EQ(expected(prefix, 9), texts(prefix, 9)) << toUtf8(prefix);
+        }
+        // the matches of some prefixes span several leaf pages
+        ASSERT_GT(longest, 3 * 8u);
+        ASSERT_EQ(headings, texts(u"", -1));
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(Tests, lenTableDeepCodesTest) {
+    LenTable lenTable;
+    readDegenerateTable(lenTable);
+
+    BitPacker message;
+    std::vector<std::tuple<unsigned, unsigned>> expected;
+    for (unsigned i = 0; i < 500; ++i) {
+        unsigned sym = (i * 7) % degenerateTableSize;
+        expected.push_back({sym, encodeSymbol(lenTable, sym, message)});
+    }
+    message.write(0, 32);
+
+    InMemoryStream ras(message.bytes().data(), message.bytes().size());
+    BitStreamAdapter bstr(&ras);
+    MemoryBitReader reader(message.bytes());
+    for (auto [sym, len] : expected) {
+        unsigned decoded = -1;
+        ASSERT_EQ(len, lenTable.Decode(bstr, decoded));
+        ASSERT_EQ(sym, decoded);
+        decoded = -1;
+        ASSERT_EQ(len, lenTable.Decode(reader, decoded));
+        ASSERT_EQ(sym, decoded);
+    }
+}
+
+TEST(Tests, symbolRunTableTest) {
+    LenTable lenTable;
+    readDegenerateTable(lenTable);
+    std::vector<char32_t> symbols;
+    for (unsigned i = 0; i < degenerateTableSize; ++i) {
+        symbols.push_back(U'a' + i);
+    }
+    SymbolRunTable runs;
+    runs.Build(lenTable, symbols);
+
+    BitPacker message;
+    std::vector<std::u16string> headings;
+    for (unsigned i = 0; i < 300; ++i) {
+        std::u16string heading;
+        for (unsigned j = 0; j < i % 9; ++j) {
+            unsigned sym = (i * j) % 5 ? (i + j) % 3 : (i * 7 + j) % degenerateTableSize;
+            encodeSymbol(lenTable, sym, message);
+            heading += symbols[sym];
+        }
+        headings.push_back(heading);
+    }
+    message.write(0, 32);
+
+    MemoryBitReader reader(message.bytes());
+    std::u16string decoded;
+    for (auto& heading : headings) {
+        runs.Decode(reader, lenTable, symbols, heading.size(), decoded);
+        ASSERT_EQ(heading, decoded);
+    }
+}
+
 TEST(Tests, extHeadingsTest) {
     std::ifstream f(testPath("simple_testdict1/testext.lsd"), std::ios::binary);
     ASSERT_TRUE(f.is_open());
@@ -292,3 +1199,172 @@ TEST(tests, outputDslName) {
 
     ASSERT_EQ(expected, fileNames);
 }
+
+TEST(tests, parallelZipWriterTest) {
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> files;
+    for (int i = 0; i < 200; ++i) {
+        std::vector<uint8_t> data(i * 97);
+        for (size_t j = 0; j < data.size(); ++j) {
+            data[j] = (j * j + i) % (i % 7 + 2);
+        }
+        files.emplace_back(fmt::format("file{}.bin", i), std::move(data));
+    }
+    auto path = std::filesystem::path("parallelZip.zip");
+    {
+        ParallelZipWriter zip(path, 4);
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto& [name, data] = files[i];
+            if (i % 3) {
+                zip.addFile(name, data.data(), data.size());
+                continue;
+            }
+            std::vector<uint8_t> deflated(compressBound(data.size()));
+            uLongf size = deflated.size();
+            compress(deflated.data(), &size, data.data(), data.size());
+            zip.addRawFile(name, deflated.data() + 2, size - 6, crc32(0, data.data(), data.size()), data.size());
+        }
+        zip.finish();
+    }
+
+    auto unz = unzOpen64(path.string().c_str());
+    ASSERT_TRUE(unz);
+    ASSERT_EQ(UNZ_OK, unzGoToFirstFile(unz));
+    for (auto& [name, data] : files) {
+        char fileName[256];
+        unz_file_info64 info;
+        ASSERT_EQ(UNZ_OK, unzGetCurrentFileInfo64(unz, &info, fileName, sizeof(fileName), nullptr, 0, nullptr, 0));
+        ASSERT_EQ(name, fileName);
+        std::vector<uint8_t> read(info.uncompressed_size);
+        ASSERT_EQ(UNZ_OK, unzOpenCurrentFile(unz));
+        ASSERT_EQ((int)read.size(), unzReadCurrentFile(unz, read.data(), read.size()));
+        ASSERT_EQ(UNZ_OK, unzCloseCurrentFile(unz)); // checks the crc
+        ASSERT_EQ(data, read);
+        unzGoToNextFile(unz);
+    }
+    unzClose(unz);
+}
+
+TEST(tests, zipStoresCompressedMediaTest) {
+    std::string png = "\x89PNG\r\n\x1a\n" + std::string(1000, 'a');
+    std::string text(1000, 'a');
+    ASSERT_TRUE(isCompressedMedia(png.data(), png.size()));
+    ASSERT_FALSE(isCompressedMedia(text.data(), text.size()));
+    ASSERT_TRUE(isCompressedMedia("OggS", 4));
+    ASSERT_FALSE(isCompressedMedia("Ogg", 3));
+
+    for (int level : {-1, 0, 9}) {
+        auto path = std::filesystem::path(fmt::format("level{}.zip", level));
+        {
+            ParallelZipWriter zip(path, 2, level);
+            zip.addFile("image.png", png.data(), png.size());
+            zip.addFile("text.txt", text.data(), text.size());
+            zip.finish();
+        }
+        auto unz = unzOpen64(path.string().c_str());
+        ASSERT_TRUE(unz);
+        for (auto [name, data] : {std::pair{"image.png", &png}, std::pair{"text.txt", &text}}) {
+            ASSERT_EQ(UNZ_OK, unzLocateFile(unz, name, 1));
+            unz_file_info64 info;
+            ASSERT_EQ(UNZ_OK, unzGetCurrentFileInfo64(unz, &info, nullptr, 0, nullptr, 0, nullptr, 0));
+            bool stored = level == 0 || data == &png;
+            ASSERT_EQ(stored ? 0 : Z_DEFLATED, info.compression_method);
+            std::string read(info.uncompressed_size, 0);
+            ASSERT_EQ(UNZ_OK, unzOpenCurrentFile(unz));
+            ASSERT_EQ((int)read.size(), unzReadCurrentFile(unz, read.data(), read.size()));
+            ASSERT_EQ(UNZ_OK, unzCloseCurrentFile(unz));
+            ASSERT_EQ(*data, read);
+        }
+        unzClose(unz);
+    }
+}
+
+TEST(tests, zipStreamedEntryTest) {
+    std::string large;
+    for (int i = 0; i < 300000; ++i) {
+        large += fmt::format("{} ", i * 31 % 10007);
+    }
+    std::string png = "\x89PNG\r\n\x1a\n" + large;
+    auto path = std::filesystem::path("streamed.zip");
+    {
+        ParallelZipWriter zip(path, 2);
+        zip.addFile("before.txt", large.data(), 1000);
+        for (auto [name, data] : {std::pair{"large.txt", &large}, std::pair{"large.png", &png}}) {
+            zip.openFile(name);
+            for (size_t pos = 0; pos < data->size(); pos += 65536) {
+                zip.writeFile(data->data() + pos, std::min<size_t>(65536, data->size() - pos));
+            }
+            zip.closeFile();
+        }
+        zip.openFile("empty.txt");
+        ASSERT_THROW(zip.addFile("inside.txt", large.data(), 10), std::runtime_error);
+        zip.closeFile();
+        zip.addFile("after.txt", large.data(), 2000);
+        zip.finish();
+    }
+
+    auto unz = unzOpen64(path.string().c_str());
+    ASSERT_TRUE(unz);
+    ASSERT_EQ(UNZ_OK, unzGoToFirstFile(unz));
+    std::tuple<std::string, std::string, int> expected[] = {
+        {"before.txt", large.substr(0, 1000), Z_DEFLATED},
+        {"large.txt", large, Z_DEFLATED},
+        {"large.png", png, 0},
+        {"empty.txt", "", Z_DEFLATED},
+        {"after.txt", large.substr(0, 2000), Z_DEFLATED},
+    };
+    for (auto& [name, data, method] : expected) {
+        char fileName[256];
+        unz_file_info64 info;
+        ASSERT_EQ(UNZ_OK, unzGetCurrentFileInfo64(unz, &info, fileName, sizeof(fileName), nullptr, 0, nullptr, 0));
+        ASSERT_EQ(name, fileName);
+        ASSERT_EQ(method, (int)info.compression_method);
+        std::string read(info.uncompressed_size, 0);
+        ASSERT_EQ(UNZ_OK, unzOpenCurrentFile(unz));
+        ASSERT_EQ((int)read.size(), unzReadCurrentFile(unz, read.data(), read.size()));
+        ASSERT_EQ(UNZ_OK, unzCloseCurrentFile(unz));
+        ASSERT_EQ(data, read);
+        unzGoToNextFile(unz);
+    }
+    unzClose(unz);
+}
+
+TEST(tests, dslWriterTest) {
+    {
+        dsl::Writer writer(".", "writerTest");
+        writer.writeHeading(u"heading");
+        writer.writeArticle(u"line1\nline2\n\nline4");
+        writer.writeHeading(std::u16string(u"cut\0off", 7));
+        writer.writeArticle(u"");
+    }
+    std::ifstream f("writerTest.dsl", std::ios::binary);
+    std::string bytes(std::istreambuf_iterator<char>(f), {});
+    ASSERT_EQ(0, bytes.size() % 2);
+    std::u16string text(bytes.size() / 2 - 1, 0);
+    std::memcpy(text.data(), bytes.data() + 2, text.size() * 2);
+    ASSERT_EQ(u"heading\n\tline1\n\tline2\n\t\n\tline4\ncut\n\t\n", text);
+}
+
+TEST(tests, parallelWriteDslTest) {
+    auto readFile = [](std::filesystem::path path) {
+        std::ifstream f(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(f), {});
+    };
+    for (auto name : {"headingsTestDict1_x5", "variants_testdict", "overlay_x5", "unsorted_testdict"}) {
+        TestLog log;
+        MappedFileStream ras(testPath(fmt::format("simple_testdict1/{}.lsd", name).c_str()));
+        BitStreamAdapter bstr(&ras);
+        LSDDictionary reader(&bstr);
+        for (bool dumb : {false, true}) {
+            std::string contents[2];
+            for (unsigned threads : {1, 4}) {
+                auto outPath = fmt::format("parallelOut{}", threads);
+                std::filesystem::remove_all(outPath);
+                std::filesystem::create_directories(outPath);
+                writeDSL(&reader, fmt::format("{}.lsd", name), outPath, dumb, log, threads);
+                contents[threads > 1] = readFile(std::filesystem::path(outPath) / fmt::format("{}.dsl", name));
+            }
+            ASSERT_FALSE(contents[0].empty());
+            ASSERT_EQ(contents[0], contents[1]);
+        }
+    }
+}